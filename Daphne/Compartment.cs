@@ -481,9 +481,30 @@ namespace Daphne
             }
         }
 
+        /// <summary>
+        /// apply the diffusion options of the scenario environment
+        /// </summary>
+        /// <param name="config">the ecs environment configuration</param>
+        public void ConfigureDiffusion(ConfigECSEnvironment config)
+        {
+            Nt_MolecularPopulation.SubcycleDiffusion = config.subcycle_diffusion;
+
+            // fail at load rather than in the first step
+            if (config.diffusion_scheme == Nt_DiffusionScheme.Spectral && toroidal == false)
+            {
+                throw new Exception("Spectral diffusion requires a toroidal environment.");
+            }
+            Nt_ECS ecs = comp.BaseComp as Nt_ECS;
+            ecs.DiffusionScheme = config.diffusion_scheme;
+            ecs.BatchDiffusion = config.batch_diffusion;
+            ecs.ActiveRegionDiffusion = config.active_region_diffusion;
+            ecs.ActiveRegionTolerance = config.active_region_tolerance;
+        }
+
         public override void Step(double dt)
         {
             this.Comp.Step(dt);
+            Nt_ECS ecs = comp.BaseComp as Nt_ECS;
             
             //apply ECS/membrane boundary flux 
             foreach (KeyValuePair<string, MolecularPopulation> kvp in Comp.Populations)
@@ -492,14 +513,38 @@ namespace Daphne
                 if (molpop.IsDiffusing == false) continue;
                 ScalarField conc = molpop.Conc;
 
-                //apply ECS/membrane boundary flux
-                foreach (KeyValuePair<int, ScalarField> item in molpop.BoundaryFluxes)
+                //apply ECS/membrane boundary flux, the fluxes of all cells are deposited in one native pass
+                int nflux = molpop.BoundaryFluxes.Count;
+                if (nflux > 0 && ecs != null && molpop.boundaryCondition.Count == 0)
                 {
-                    conc.DiffusionFluxTerm(item.Value, molpop.Comp.BoundaryTransforms[item.Key], dt);
-                    item.Value.reset(0);
+                    //nothing changes the concentration before UpdateBoundary(), the boundary
+                    //concentrations are restricted in the same pass
+                    ecs.ExchangeBoundary(molpop.MoleculeKey, dt);
+                }
+                else if (nflux > 0)
+                {
+                    ScalarField[] fluxes = new ScalarField[nflux];
+                    Transform[] transforms = new Transform[nflux];
+                    int i = 0;
+                    foreach (KeyValuePair<int, ScalarField> item in molpop.BoundaryFluxes)
+                    {
+                        fluxes[i] = item.Value;
+                        transforms[i] = molpop.Comp.BoundaryTransforms[item.Key];
+                        i++;
+                    }
+                    conc.DiffusionFluxTerm(fluxes, transforms, dt);
+                    foreach (ScalarField flux in fluxes)
+                    {
+                        flux.reset(0);
+                    }
                 }
 
                 // Apply natural boundary condition
+                if (molpop.boundaryCondition.Count > 0 && ecs != null)
+                {
+                    // the faces change outside of the ecs step, see Nt_ECS.ActiveRegionDiffusion
+                    ecs.MarkActiveBoundary(molpop.MoleculeKey);
+                }
                 foreach (KeyValuePair<int, MolBoundaryType> bc in molpop.boundaryCondition)
                 {
                     if (bc.Value == MolBoundaryType.Dirichlet)
@@ -751,6 +751,99 @@ namespace Daphne
             protocol.scenario.time_config.integrator_step = 0.001;
         }
 
+        /// <summary>
+        /// Cell list scaling scenario: 1,000,000 cells on a jittered 100^3 lattice in a 2000 um cube.
+        /// The collision grid step is 2 * Cell.defaultRadius = 10, so the cell list has 200^3 voxels.
+        /// There are no molecules or reactions, so the run time is dominated by the pair rebuild and
+        /// the force pass. Generate it by uncommenting the entry in MainWindow.CreateAndSerializeDaphneProtocols,
+        /// load cell_list_scaling.json and time the run; the cell positions are fixed by the lattice and
+        /// the seed, so repeated runs and runs on different machines are comparable.
+        /// </summary>
+        public static void CreateCellListScalingProtocol(Protocol protocol)
+        {
+            if (protocol.CheckScenarioType(Protocol.ScenarioType.TISSUE_SCENARIO) == false)
+            {
+                throw new InvalidCastException();
+            }
+
+            protocol.Version = System.Reflection.Assembly.GetExecutingAssembly().GetName().Version.Minor;
+
+            protocol.InitializeStorageClasses();
+
+            // Load reaction templates from userstore
+            Level userstore = new Level("Config\\Stores\\userstore.json", "Config\\Stores\\temp_userstore.json");
+            userstore = userstore.Deserialize();
+            LoadProtocolReactionTemplates(protocol, userstore);
+
+            ConfigECSEnvironment envHandle = (ConfigECSEnvironment)protocol.scenario.environment;
+
+            // Experiment
+            protocol.experiment_name = "Cell list scaling";
+            protocol.experiment_description = "1,000,000 cells in a 2000 um cube, 200^3 collision voxels, no molecules.";
+            protocol.scenario.time_config.duration = 1;
+            protocol.scenario.time_config.rendering_interval = protocol.scenario.time_config.duration;
+            protocol.scenario.time_config.sampling_interval = protocol.scenario.time_config.duration;
+            protocol.scenario.time_config.integrator_step = 0.001;
+
+            // a coarse ECS grid, it only has to exist
+            envHandle.gridstep = 50;
+            envHandle.extent_x = 2000;
+            envHandle.extent_y = 2000;
+            envHandle.extent_z = 2000;
+
+            ConfigCell configCell = new ConfigCell();
+            configCell.CellName = "Cell list scaling";
+            configCell.CellRadius = 5.0;
+            configCell.description = "Cell without molecules for the cell list scaling scenario.";
+            // Turn off stochastic motion
+            configCell.Sigma.ConstValue = 0.0;
+
+            // Add cell population
+            CellPopulation cellPop = new CellPopulation();
+            cellPop.Cell = configCell.Clone(true);
+            cellPop.cellpopulation_name = configCell.CellName;
+            double[] extents = new double[3] { envHandle.extent_x, envHandle.extent_y, envHandle.extent_z };
+            double minDisSquared = 2 * configCell.CellRadius;
+            minDisSquared *= minDisSquared;
+            cellPop.cellPopDist = new CellPopSpecific(extents, minDisSquared, cellPop);
+
+            // fixed seed, without disturbing the shared generators
+            Random rand = new Random(1);
+
+            // AddByDistr checks every new cell against all placed cells, which is quadratic;
+            // place the cells directly on a lattice, jittered by up to 1.5 radii so that some neighbors overlap,
+            // and keep them a radius away from the walls
+            int side = 100;
+            double spacing = envHandle.extent_x / side,
+                   jitter = 1.5 * configCell.CellRadius,
+                   lo = configCell.CellRadius,
+                   hi = envHandle.extent_x - configCell.CellRadius;
+            Func<int, double> coordinate = n => Math.Min(hi, Math.Max(lo, (n + 0.5) * spacing + jitter * (2 * rand.NextDouble() - 1)));
+
+            for (int i = 0; i < side; i++)
+            {
+                for (int j = 0; j < side; j++)
+                {
+                    for (int k = 0; k < side; k++)
+                    {
+                        cellPop.CellStates.Add(new CellState(coordinate(i), coordinate(j), coordinate(k)));
+                    }
+                }
+            }
+            cellPop.number = cellPop.CellStates.Count;
+
+            // Cell reporting
+            cellPop.report_xvf.position = false;
+            cellPop.report_xvf.velocity = false;
+            cellPop.report_xvf.force = false;
+
+            ((TissueScenario)protocol.scenario).cellpopulations.Add(cellPop);
+            //rendering
+            ((TissueScenario)protocol.scenario).popOptions.AddRenderOptions(cellPop.renderLabel, cellPop.cellpopulation_name, true);
+
+            protocol.reporter_file_name = "cell_list_scaling";
+        }
+
         public static void CreateVatRC_Blank_Protocol(Protocol protocol)
         {
             if (protocol.CheckScenarioType(Protocol.ScenarioType.VAT_REACTION_COMPLEX) == false)
@@ -22,6 +22,7 @@ using System.Numerics;
 using System.IO;
 
 using Nt_ManifoldRing;
+using NativeDaphne;
 using System.Globalization;
 
 namespace Daphne
@@ -367,12 +368,31 @@ namespace Daphne
             {
                 // simulation time
                 ecm_mean_file.Write(hSim.AccumulatedTime);
+                List<string> keys = new List<string>();
                 foreach (ConfigMolecularPopulation c in SimulationBase.ProtocolHandle.scenario.environment.comp.molpops)
                 {
                     if (((ReportECM)c.report_mp).mean == true)
+                    {
+                        keys.Add(c.molecule.entity_guid);
+                    }
+                }
+
+                Nt_ECS ecs = SimulationBase.dataBasket.Environment.Comp.BaseComp as Nt_ECS;
+                if (ecs != null && SimulationBase.ProtocolHandle.scenario.simInterpolate == SimStates.Linear)
+                {
+                    // all means in one native pass, the report holds integral, mean, min and max per molecule
+                    double[] report = ecs.ConcentrationReport(keys.ToArray());
+                    for (int i = 0; i < keys.Count; i++)
+                    {
+                        ecm_mean_file.Write("\t{0:G4}", report[4 * i + 1]);
+                    }
+                }
+                else
+                {
+                    foreach (string key in keys)
                     {
                         // mean concentration of this ecm molecular population
-                        ecm_mean_file.Write("\t{0:G4}", SimulationBase.dataBasket.Environment.Comp.Populations[c.molecule.entity_guid].Conc.MeanValue());
+                        ecm_mean_file.Write("\t{0:G4}", SimulationBase.dataBasket.Environment.Comp.Populations[key].Conc.MeanValue());
                     }
                 }
                 // terminate line
@@ -3362,6 +3362,92 @@ namespace Daphne
             }
         }
 
+        // explicit diffusion in substeps below the stable step of each molecule, see Nt_MolecularPopulation.SubcycleDiffusion
+        private bool _subcycle_diffusion;
+        public bool subcycle_diffusion
+        {
+            get { return _subcycle_diffusion; }
+            set
+            {
+                if (_subcycle_diffusion == value)
+                    return;
+                else
+                {
+                    _subcycle_diffusion = value;
+                    OnPropertyChanged("subcycle_diffusion");
+                }
+            }
+        }
+
+        // diffuse all ecs molecules in one sweep over the grid, see Nt_ECS.BatchDiffusion
+        private bool _batch_diffusion;
+        public bool batch_diffusion
+        {
+            get { return _batch_diffusion; }
+            set
+            {
+                if (_batch_diffusion == value)
+                    return;
+                else
+                {
+                    _batch_diffusion = value;
+                    OnPropertyChanged("batch_diffusion");
+                }
+            }
+        }
+
+        // explicit diffusion of the non-uniform tiles of the grid only, see Nt_ECS.ActiveRegionDiffusion.
+        // a tile is skipped when its values vary by no more than active_region_tolerance; 0 skips only exactly uniform tiles.
+        private bool _active_region_diffusion;
+        public bool active_region_diffusion
+        {
+            get { return _active_region_diffusion; }
+            set
+            {
+                if (_active_region_diffusion == value)
+                    return;
+                else
+                {
+                    _active_region_diffusion = value;
+                    OnPropertyChanged("active_region_diffusion");
+                }
+            }
+        }
+
+        private double _active_region_tolerance;
+        public double active_region_tolerance
+        {
+            get { return _active_region_tolerance; }
+            set
+            {
+                if (_active_region_tolerance == value)
+                    return;
+                else
+                {
+                    _active_region_tolerance = value;
+                    OnPropertyChanged("active_region_tolerance");
+                }
+            }
+        }
+
+        // time integration of the ecs diffusion; the implicit schemes are stable for any step,
+        // Spectral is exact but requires a toroidal environment
+        private Nt_DiffusionScheme _diffusion_scheme;
+        public Nt_DiffusionScheme diffusion_scheme
+        {
+            get { return _diffusion_scheme; }
+            set
+            {
+                if (_diffusion_scheme == value)
+                    return;
+                else
+                {
+                    _diffusion_scheme = value;
+                    OnPropertyChanged("diffusion_scheme");
+                }
+            }
+        }
+
         public ConfigECSEnvironment()
         {
             gridstep = 10;
@@ -3374,6 +3460,11 @@ namespace Daphne
             gridstep_max = 100;
             initialized = true;
             toroidal = false;
+            subcycle_diffusion = true;
+            diffusion_scheme = Nt_DiffusionScheme.Explicit;
+            batch_diffusion = true;
+            active_region_diffusion = false;
+            active_region_tolerance = 0;
 
             // Don't need to check the boolean returned, since we know these values are okay.
             CalculateNumGridPts();
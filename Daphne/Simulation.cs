@@ -1402,6 +1402,7 @@ namespace Daphne
             }
             //INSTANTIATE EXTRA CELLULAR MEDIUM
             dataBasket.Environment = SimulationModule.kernel.Get<ECSEnvironment>();
+            ((ECSEnvironment)dataBasket.Environment).ConfigureDiffusion(envHandle);
 
             // clear the databasket dictionaries
             dataBasket.Clear();
@@ -768,6 +768,11 @@ namespace DaphneGui
             ////Serialize to json
             //protocol.SerializeToFile();
 
+            ////CELL LIST SCALING SCENARIO - 1M cells, for timing the collision pass, only
+            //protocol = new Protocol("Config\\cell_list_scaling.json", "Config\\temp_protocol.json", Protocol.ScenarioType.TISSUE_SCENARIO);
+            //ProtocolCreators.CreateCellListScalingProtocol(protocol);
+            //protocol.SerializeToFile();
+
             // RECEPTOR HOMEOSTASIS Protocol
             protocol = new Protocol("Config\\receptor_homeostasis.json", "Config\\temp_protocol.json", Protocol.ScenarioType.TISSUE_SCENARIO);
             ProtocolCreators.CreateLigandReceptorProtocol(protocol);
@@ -19,7 +19,9 @@ THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "Nt_MolecularPopulation.h"
 #include "Nt_Reaction.h"
 #include "NtInterpolatedRectangularPrism.h"
+#include "NtActiveRegion.h"
 #include "Nt_Manifolds.h"
+#include "Nt_Interpolation.h"
 
 using namespace System;
 using namespace System::Collections::Generic;
@@ -31,11 +33,19 @@ namespace NativeDaphne
 
 	public enum class Nt_ManifoldType {TinyBall, TinySphere, InterpolatedRectangularPrism, TinyBallCollection, TinySphereCollection};
 
+	//time stepping used for ecs diffusion, the implicit schemes are unconditionally stable
+	//Spectral is exact but needs a toroidal ecs
+	public enum class Nt_DiffusionScheme {Explicit, CrankNicolson, BackwardEuler, Spectral};
+
 	public ref class Nt_Compartment
     {
 	protected:
 		bool initialized;
 
+		//called when a population is added or gets a new component, before any
+		//reaction caches its concentration pointer
+		virtual void population_added(Nt_MolecularPopulation^ pop){}
+
 	internal:
 
 		void AddBulkReaction(List<Nt_Reaction^>^ rxns)
@@ -101,10 +111,13 @@ namespace NativeDaphne
 					Nt_MolecularPopulation^ child = item->ComponentPopulations[0];
 					double *child_c = child->ConcPointer;
 					double y = child_c[0];
+					population_added(item);
 					return;
 				}
 			}
-			NtPopulations->Add(molpop->CloneParent(this));
+			Nt_MolecularPopulation^ pop = molpop->CloneParent(this);
+			NtPopulations->Add(pop);
+			population_added(pop);
         }
 
 		void AddMolecularPopulation(List<Nt_MolecularPopulation^>^ molpop_list)
@@ -549,8 +562,10 @@ namespace NativeDaphne
 	public:
 		int* NodesPerSide;
 		double StepSize;
-		bool IsToroidal;
 		NtInterpolatedRectangularPrism *ir_prism;
+		//the interpolator of the ecs when it is tricubic, the boundary restrict and
+		//flux exchange go through it instead of the trilinear ir_prism
+		Tricubic3D^ tricubic;
 		bool initialized;
 
 		//here boundary reactions need to be organized diffrently than in cytosol
@@ -563,6 +578,37 @@ namespace NativeDaphne
 
 		List<int>^ BoundaryKeys; //to keep sync with boundary in molpop
 
+		//the native prism builds its restrict tables for the boundary condition,
+		//so it is rebuilt when this is changed after construction.
+		property bool IsToroidal
+		{
+			bool get()
+			{
+				return isToroidal;
+			}
+			void set(bool value)
+			{
+				if (value == isToroidal)return;
+				isToroidal = value;
+				//the tile halos depend on the boundary condition
+				free_active_regions();
+				delete ir_prism;
+				ir_prism = new NtInterpolatedRectangularPrism(NodesPerSide, StepSize, isToroidal);
+			}
+		}
+
+		//diffuse all ecs populations in one species-interleaved sweep
+		//see NtInterpolatedRectangularPrism::DiffuseMulti
+		bool BatchDiffusion;
+		Nt_DiffusionScheme DiffusionScheme;
+		double **diffusionArrays;
+		double *diffusionCoefs;
+
+		//explicit diffusion of the non-uniform tiles only, see NtActiveRegion.
+		//a tile is skipped when its values and halo are within ActiveRegionTolerance.
+		bool ActiveRegionDiffusion;
+		double ActiveRegionTolerance;
+
 		Nt_ECS(InterpolatedRectangularPrism^ m) : Nt_Compartment(Nt_ManifoldType::InterpolatedRectangularPrism)
 		{
 			NodesPerSide = (int *)malloc(3 * sizeof(int));
@@ -570,15 +616,27 @@ namespace NativeDaphne
 			NodesPerSide[1] = m->NodesPerSide(1);;
 			NodesPerSide[2] = m->NodesPerSide(2);;
 			StepSize = m->StepSize();
-			//IsToroidal = toroidal;
+			//toroidal is set afterwards through IsToroidal
+			isToroidal = false;
 			BoundaryTransforms = gcnew Dictionary<int, Transform^>();
-			ir_prism = new NtInterpolatedRectangularPrism(NodesPerSide, StepSize, IsToroidal);
+			ir_prism = new NtInterpolatedRectangularPrism(NodesPerSide, StepSize, isToroidal);
+			tricubic = dynamic_cast<Tricubic3D^>(m->Interp);
 
 			//data used for updateBounary
 			Positions = NULL;
 			BoundaryKeys = gcnew List<int>();
 			boundaryReactions = gcnew Dictionary<int, Nt_ReactionSet^>();
 
+			BatchDiffusion = false;
+			DiffusionScheme = Nt_DiffusionScheme::Explicit;
+			diffusionArrays = NULL;
+			diffusionCoefs = NULL;
+
+			ActiveRegionDiffusion = false;
+			ActiveRegionTolerance = 0;
+			activeRegions = NULL;
+			activeRegionCount = 0;
+
 			initialized = false;
 		}
 
@@ -591,15 +649,26 @@ namespace NativeDaphne
 			NodesPerSide[1] = extents[1];
 			NodesPerSide[2] = extents[2];
 			StepSize = step_size;
-			IsToroidal = toroidal;
+			isToroidal = toroidal;
 			BoundaryTransforms = gcnew Dictionary<int, Transform^>();
-			ir_prism = new NtInterpolatedRectangularPrism(NodesPerSide, StepSize, IsToroidal);
+			ir_prism = new NtInterpolatedRectangularPrism(NodesPerSide, StepSize, isToroidal);
+			tricubic = nullptr;
 
 			//data used for updateBounary
 			Positions = NULL;
 			BoundaryKeys = gcnew List<int>();
 			boundaryReactions = gcnew Dictionary<int, Nt_ReactionSet^>();
 
+			BatchDiffusion = false;
+			DiffusionScheme = Nt_DiffusionScheme::Explicit;
+			diffusionArrays = NULL;
+			diffusionCoefs = NULL;
+
+			ActiveRegionDiffusion = false;
+			ActiveRegionTolerance = 0;
+			activeRegions = NULL;
+			activeRegionCount = 0;
+
 			initialized = false;
 		}
 
@@ -611,6 +680,9 @@ namespace NativeDaphne
 		!Nt_ECS()
 		{
 			delete ir_prism;
+			free(diffusionArrays);
+			free(diffusionCoefs);
+			free_active_regions();
 		}
 
 		//here key is membrane's interor id
@@ -631,6 +703,19 @@ namespace NativeDaphne
 			NtBulkReactions->Add(rxn->CloneParent());
 		}
 
+	protected:
+		//move the concentration to storage first touched by the diffusion threads,
+		//so each z slab lives on the numa node of the thread that updates it.
+		virtual void population_added(Nt_MolecularPopulation^ pop) override
+		{
+			Nt_Darray^ darray = pop->Conc->darray;
+			if (darray->IsPointerOwner == false || darray->Length != NodesPerSide[0] * NodesPerSide[1] * NodesPerSide[2])return;
+			double *dst = (double *)_aligned_malloc(darray->Length * sizeof(double), 32);
+			ir_prism->FirstTouchCopy(dst, darray->NativePointer);
+			darray->ReplaceStorage(dst);
+		}
+
+	public:
 
 		void initialize()
 		{
@@ -705,6 +790,19 @@ namespace NativeDaphne
 				 }
 			}
 
+			if (ActiveRegionDiffusion == true && DiffusionScheme == Nt_DiffusionScheme::Explicit)
+			{
+				diffuse_active(dt);
+				return;
+			}
+
+			//a single species diffuses in place, see Nt_MolecularPopulation::step
+			if (BatchDiffusion == true && DiffusionScheme == Nt_DiffusionScheme::Explicit && diffusing_count() > 1)
+			{
+				diffuse_batched(dt);
+				return;
+			}
+
 			//for now, this is doing update ecs/membrane boundary
 			//this is disabled for handling reactions ONLY
 			for (int i=0; i< NtPopulations->Count; i++)
@@ -713,6 +811,144 @@ namespace NativeDaphne
 			}
 		}
 
+		int diffusing_count()
+		{
+			int n = 0;
+			for (int i=0; i< NtPopulations->Count; i++)
+			{
+				if (NtPopulations[i]->IsDiffusing == true)n++;
+			}
+			return n;
+		}
+
+		//one sweep for all diffusing populations instead of one per population.
+		//with sub-cycling, sweep r only includes the populations needing more than r substeps.
+		void diffuse_batched(double dt)
+		{
+			int count = NtPopulations->Count;
+			diffusionArrays = (double **)realloc(diffusionArrays, count * sizeof(double *));
+			diffusionCoefs = (double *)realloc(diffusionCoefs, count * sizeof(double));
+			int max_substeps = 1;
+			for (int round = 0; round < max_substeps; round++)
+			{
+				int n = 0;
+				for (int i=0; i< count; i++)
+				{
+					Nt_MolecularPopulation^ pop = NtPopulations[i];
+					if (pop->IsDiffusing == false)continue;
+					int nsub = pop->DiffusionSubsteps(dt, StepSize * StepSize / (6 * pop->DiffusionCoefficient));
+					if (nsub > max_substeps)max_substeps = nsub;
+					if (nsub <= round)continue;
+					diffusionArrays[n] = pop->ConcPointer;
+					diffusionCoefs[n] = pop->DiffusionCoefficient * dt / nsub;
+					n++;
+				}
+				if (n > 0)
+				{
+					ir_prism->DiffuseMulti(diffusionArrays, diffusionCoefs, n);
+				}
+			}
+		}
+
+		//the cell fluxes are deposited around the cell positions, these tiles are re-evaluated
+		//each step. with bulk reactions, a tile changing for one species is re-evaluated for all.
+		void diffuse_active(double dt)
+		{
+			int count = NtPopulations->Count;
+			if (count > activeRegionCount)
+			{
+				activeRegions = (NtActiveRegion **)realloc(activeRegions, count * sizeof(NtActiveRegion *));
+				for (int i = activeRegionCount; i < count; i++)activeRegions[i] = NULL;
+				activeRegionCount = count;
+			}
+			int num_positions = BoundaryKeys->Count;
+			for (int i=0; i< count; i++)
+			{
+				if (NtPopulations[i]->IsDiffusing == false)continue;
+				if (activeRegions[i] == NULL)
+				{
+					activeRegions[i] = new NtActiveRegion(NodesPerSide, isToroidal, ActiveRegionTolerance);
+				}
+				NtActiveRegion *region = activeRegions[i];
+				region->Tolerance = ActiveRegionTolerance;
+				for (int j=0; j< num_positions; j++)
+				{
+					region->MarkPosition(Positions[j], StepSize);
+				}
+				if (NtBulkReactions->Count == 0)continue;
+				for (int j=0; j< count; j++)
+				{
+					if (j != i && activeRegions[j] != NULL)region->MarkActiveOf(activeRegions[j]);
+				}
+			}
+
+			for (int i=0; i< count; i++)
+			{
+				Nt_MolecularPopulation^ pop = NtPopulations[i];
+				if (pop->IsDiffusing == false)continue;
+				int nsub = pop->DiffusionSubsteps(dt, StepSize * StepSize / (6 * pop->DiffusionCoefficient));
+				double alpha = pop->DiffusionCoefficient * dt / nsub;
+				for (int j=0; j< nsub; j++)
+				{
+					ir_prism->DiffuseActive(pop->ConcPointer, alpha, activeRegions[i]);
+				}
+			}
+		}
+
+		//the natural boundary conditions change the faces of the grid outside of step()
+		void MarkActiveBoundary(String^ moleculeKey)
+		{
+			for (int i=0; i< NtPopulations->Count && i < activeRegionCount; i++)
+			{
+				if (NtPopulations[i]->MoleculeKey == moleculeKey && activeRegions[i] != NULL)
+				{
+					activeRegions[i]->MarkBoundary();
+				}
+			}
+		}
+
+		//integral, mean, min and max of the concentration of each molecule in one native pass,
+		//NtInterpolatedRectangularPrism::REDUCE_VALUES per molecule. the integral is the voxel
+		//center sum of trilinear interpolation, see NtInterpolatedRectangularPrism::FieldReduce
+		array<double>^ ConcentrationReport(array<String^>^ moleculeKeys)
+		{
+			int n = moleculeKeys->Length;
+			int nvalues = NtInterpolatedRectangularPrism::REDUCE_VALUES;
+			array<double>^ retval = gcnew array<double>(n * nvalues);
+			if (n == 0)return retval;
+			double **sfarrays = (double **)malloc(n * sizeof(double *));
+			for (int i=0; i< n; i++)
+			{
+				sfarrays[i] = NULL;
+				for (int j=0; j< NtPopulations->Count; j++)
+				{
+					if (NtPopulations[j]->MoleculeKey == moleculeKeys[i])
+					{
+						sfarrays[i] = NtPopulations[j]->ConcPointer;
+						break;
+					}
+				}
+				if (sfarrays[i] == NULL)
+				{
+					free(sfarrays);
+					throw gcnew Exception("ConcentrationReport: molecule not found in ecs");
+				}
+			}
+			pin_ptr<double> report = &retval[0];
+			ir_prism->FieldReduce(sfarrays, n, report);
+			free(sfarrays);
+			return retval;
+		}
+
+		//re-evaluate all tiles, e.g. after the concentrations are set from outside
+		void ResetActiveRegions()
+		{
+			for (int i=0; i< activeRegionCount; i++)
+			{
+				if (activeRegions[i] != NULL)activeRegions[i]->MarkAll();
+			}
+		}
+
 		virtual void UpdateBoundary() override
 		{
 			for (int i=0; i< NtPopulations->Count; i++)
@@ -720,7 +956,38 @@ namespace NativeDaphne
 				NtPopulations[i]->UpdateBoundary(this);
 			}
 		}
-		
+
+		//apply the cell boundary fluxes of the population and restrict its boundary
+		//concentrations in one pass, see Nt_MolecularPopulation::ExchangeBoundary()
+		void ExchangeBoundary(String^ moleculeKey, double dt)
+		{
+			for (int i=0; i< NtPopulations->Count; i++)
+			{
+				if (NtPopulations[i]->MoleculeKey == moleculeKey)
+				{
+					NtPopulations[i]->ExchangeBoundary(this, dt);
+					return;
+				}
+			}
+			throw gcnew Exception("ExchangeBoundary: molecule not found in ecs");
+		}
+
+	private:
+		bool isToroidal;
+		//per population, in the order of NtPopulations
+		NtActiveRegion **activeRegions;
+		int activeRegionCount;
+
+		void free_active_regions()
+		{
+			for (int i=0; i< activeRegionCount; i++)
+			{
+				delete activeRegions[i];
+			}
+			free(activeRegions);
+			activeRegions = NULL;
+			activeRegionCount = 0;
+		}
 	};
 	
 }
\ No newline at end of file
@@ -292,6 +292,29 @@ namespace NativeDaphne
 			is_pointer_owner = true;
 		}
 
+		//move the data to dst, allocated with _aligned_malloc and already filled by the caller
+		//(e.g. with a first-touch copy), the components are repointed to the new storage.
+		void ReplaceStorage(double *dst)
+		{
+			if (is_pointer_owner == false)
+			{
+				throw gcnew Exception("Error replace memory the object does not own");
+			}
+			if (_array != NULL)
+			{
+				_aligned_free(_array);
+			}
+			_array = dst;
+			capacity = length;
+			if (component == nullptr)return;
+			double *head = _array;
+			for (int i=0; i< component->Count; i++)
+			{
+				component[i]->NativePointer = head;
+				head += component[i]->Length;
+			}
+		}
+
 		property bool IsPointerOwner
 		{
 			bool get()
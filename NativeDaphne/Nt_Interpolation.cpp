@@ -35,8 +35,12 @@ namespace Nt_ManifoldRing
 		this->m = m;
 		toroidal = _toroidal;
 		laplacian = gcnew ScalarField(m);
-		laplacianOperator = gcnew array<array<LocalMatrix>^>(m->ArraySize);
-		laplacianOperator = laplacianMatrix();
+		laplacianOperator = nullptr;
+		if (NtLaplacian != NULL)
+		{
+			delete NtLaplacian;
+			NtLaplacian = NULL;
+		}
 		gradientOperator = gcnew array<array<LocalMatrix>^>(m->Dim);
 		gradient = gcnew array<double>(m->Dim);
 	}
@@ -77,8 +81,56 @@ namespace Nt_ManifoldRing
 		return gradient;
 	}
 
+	array<array<LocalMatrix>^>^ NodeInterpolator::laplacian_operator()
+	{
+		if (laplacianOperator == nullptr)
+		{
+			laplacianOperator = gcnew array<array<LocalMatrix>^>(m->ArraySize);
+			laplacianOperator = laplacianMatrix();
+		}
+		return laplacianOperator;
+	}
+
+	void NodeInterpolator::compile_laplacian()
+	{
+		laplacian_operator();
+		int nrows = laplacianOperator->Length;
+		int *row_start = (int *)malloc((nrows + 1) * sizeof(int));
+		int total = 0;
+		for (int i = 0; i < nrows; i++)
+		{
+			row_start[i] = total;
+			total += laplacianOperator[i]->Length;
+		}
+		row_start[nrows] = total;
+		int *index = (int *)malloc((total + 1) * sizeof(int));
+		double *coefficient = (double *)malloc((total + 1) * sizeof(double));
+		for (int i = 0; i < nrows; i++)
+		{
+			array<LocalMatrix>^ row = laplacianOperator[i];
+			for (int j = 0; j < row->Length; j++)
+			{
+				index[row_start[i] + j] = row[j].Index;
+				coefficient[row_start[i] + j] = row[j].Coefficient;
+			}
+		}
+		NtLaplacian = new NtSparseOperator(nrows, row_start, index, coefficient);
+		free(row_start);
+		free(index);
+		free(coefficient);
+	}
+
 	ScalarField^ NodeInterpolator::Laplacian(ScalarField^ sf)
 	{
+		laplacian_operator();
+		if (sf->darray->Length == laplacianOperator->Length)
+		{
+			if (NtLaplacian == NULL)compile_laplacian();
+			NtLaplacian->MultithreadMultiply(sf->ArrayPointer, laplacian->ArrayPointer);
+			return laplacian;
+		}
+
+		//original method
 		for (int i = 0; i < sf->darray->Length; i++)
 		{
 			laplacian->darray[i] = 0.0;
@@ -152,6 +204,15 @@ namespace Nt_ManifoldRing
 		return dst;
 	}
 
+	ScalarField^ NodeInterpolator::DiffusionFlux(array<ScalarField^>^ fluxes, array<Transform^>^ t, ScalarField^ dst, double dt)
+	{
+		for (int i = 0; i < fluxes->Length; i++)
+		{
+			DiffusionFlux(fluxes[i], t[i], dst, dt);
+		}
+		return dst;
+	}
+
 	/// <summary>
 	/// Return a scalar field (in the volume) representing the applied flux at a surface.
 	/// Assigns the entire flux source to the closest node.
@@ -263,10 +324,82 @@ namespace Nt_ManifoldRing
 		tmp[0] = NodePerSide0;
 		tmp[1] = NodePerSide1;
 		tmp[2] = NodePerSide2;
-		NtInstance = new NtTrilinear3D(tmp, m->StepSize(), _toroidal);
+		if (NtInstance != NULL)delete NtInstance;
+		NtInstance = new NtInterpolatedRectangularPrism(tmp, m->StepSize(), _toroidal);
 		free(tmp);
 	}
 
+	void Trilinear3D::reserveDeposit(int n)
+	{
+		if (n <= depositCapacity)return;
+		free(depositPosition);
+		free(depositPointer);
+		free(depositFlux);
+		depositCapacity = n > 2 * depositCapacity ? n : 2 * depositCapacity;
+		depositPosition = (double *)malloc(3 * depositCapacity * sizeof(double));
+		depositPointer = (double **)malloc(depositCapacity * sizeof(double *));
+		depositFlux = (double *)malloc(depositCapacity * sizeof(double));
+		for (int i = 0; i < depositCapacity; i++)
+		{
+			depositPointer[i] = depositPosition + 3 * i;
+		}
+	}
+
+	int Trilinear3D::gatherFlux(ScalarField^ flux, Transform^ t, double dt, int q)
+	{
+		// The concentration source term per unit flux
+		double scale = flux->M->Area() * (-dt)/ m->VoxelVolume();
+		// t->toContaining() written straight into the native position buffer,
+		// the translation is read through its native pointer like Nt_ECS::Positions
+		double *origin = t->Translation->NativePointer;
+		double rot[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+		if (t->HasRot == true)
+		{
+			Matrix^ r = t->Rotation;
+			for (int j = 0; j < 9; j++)
+			{
+				rot[j] = r[j / 3, j % 3];
+			}
+		}
+		array<Vector^>^ points = flux->M->PrincipalPoints;
+		for (int i = 0; i < points->Length; i++, q++)
+		{
+			Vector^ x = points[i];
+			double x0 = x[0], x1 = x[1], x2 = x[2];
+			double *pos = depositPosition + 3 * q;
+			pos[0] = rot[0] * x0 + rot[1] * x1 + rot[2] * x2 + origin[0];
+			pos[1] = rot[3] * x0 + rot[4] * x1 + rot[5] * x2 + origin[1];
+			pos[2] = rot[6] * x0 + rot[7] * x1 + rot[8] * x2 + origin[2];
+			depositFlux[q] = scale * flux->darray[i];
+		}
+		return q;
+	}
+
+	ScalarField^ Trilinear3D::DiffusionFlux(ScalarField^ flux, Transform^ t, ScalarField^ dst, double dt)
+	{
+		reserveDeposit(flux->M->PrincipalPoints->Length);
+		int n = gatherFlux(flux, t, dt, 0);
+		NtInstance->NativeDepositFlux(depositPointer, depositFlux, n, dst->ArrayPointer);
+		return dst;
+	}
+
+	ScalarField^ Trilinear3D::DiffusionFlux(array<ScalarField^>^ fluxes, array<Transform^>^ t, ScalarField^ dst, double dt)
+	{
+		int n = 0;
+		for (int i = 0; i < fluxes->Length; i++)
+		{
+			n += fluxes[i]->M->PrincipalPoints->Length;
+		}
+		reserveDeposit(n);
+		n = 0;
+		for (int i = 0; i < fluxes->Length; i++)
+		{
+			n = gatherFlux(fluxes[i], t[i], dt, n);
+		}
+		NtInstance->MultithreadDepositFlux(depositPointer, depositFlux, n, dst->ArrayPointer);
+		return dst;
+	}
+
 
 	// Don't need to account for toroidal BCs with this low-order scheme. 
 	array<LocalMatrix>^ Trilinear3D::interpolationMatrix(array<double>^ x) 
@@ -943,26 +1076,14 @@ namespace Nt_ManifoldRing
 		return laplacianOperator;
 	}
 
+	// The sum of the voxel center values times the voxel volume, the center value
+	// is the mean of the 8 corners so this is a fixed weighted sum of the nodes
 	double Trilinear3D::Integration(ScalarField^ sf) 
 	{
-		array<double>^ point = gcnew array<double>(3);
-		double sum = 0;
-		for (int k = 0; k < m->NodesPerSide(2) - 1; k++)
-		{
-			for (int j = 0; j < m->NodesPerSide(1) - 1; j++)
-			{
-				for (int i = 0; i < m->NodesPerSide(0) - 1; i++)
-				{
-					point[0] = (i + 0.5) * m->StepSize();
-					point[1] = (j + 0.5) * m->StepSize();
-					point[2] = (k + 0.5) * m->StepSize();
-
-					// The value at the center of the voxel
-					sum += sf->Value(point);
-				}
-			}
-		}
-		return sum * m->StepSize() * m->StepSize() * m->StepSize();
+		double *sfarray = sf->ArrayPointer;
+		double report[NtInterpolatedRectangularPrism::REDUCE_VALUES];
+		NtInstance->FieldReduce(&sfarray, 1, report);
+		return report[0];
 	}
 
 	//for debug only - compare reuslts between managed and unmanged code
@@ -996,7 +1117,7 @@ namespace Nt_ManifoldRing
 		{
 			double *sfarray = sf->ArrayPointer;
 			double *lparray = laplacian->ArrayPointer;
-			NtInstance->Laplacian(sfarray, lparray, sf->darray->Length);
+			NtInstance->MultithreadLaplacian(sfarray, lparray, sf->darray->Length);
 			return laplacian;
 		}
 		else 
@@ -1019,6 +1140,52 @@ namespace Nt_ManifoldRing
 		{
 			gradientOperator[i] = gcnew array<LocalMatrix>(12);
 		}
+
+		int tmp[2];
+		tmp[0] = m->NodesPerSide(0);
+		tmp[1] = m->NodesPerSide(1);
+		if (NtInstance != NULL)delete NtInstance;
+		NtInstance = new NtInterpolatedRectangle(tmp, m->StepSize(), _toroidal);
+	}
+
+	double Trilinear2D::Interpolate(array<double>^ x, ScalarField^ sf)
+	{
+		if (NtInstance == NULL)
+		{
+			return NodeInterpolator::Interpolate(x, sf);
+		}
+		pin_ptr<double> xptr = &x[0];
+		double *pos = xptr;
+		double output[3];
+		double *outptr = output;
+		NtInstance->NativeRestrict(sf->ArrayPointer, &pos, 1, &outptr);
+		return output[0];
+	}
+
+	array<double>^ Trilinear2D::Gradient(array<double>^ x, ScalarField^ sf)
+	{
+		if (NtInstance == NULL)
+		{
+			return NodeInterpolator::Gradient(x, sf);
+		}
+		pin_ptr<double> xptr = &x[0];
+		double *pos = xptr;
+		double output[3];
+		double *outptr = output;
+		NtInstance->NativeRestrict(sf->ArrayPointer, &pos, 1, &outptr);
+		gradient[0] = output[1];
+		gradient[1] = output[2];
+		return gradient;
+	}
+
+	ScalarField^ Trilinear2D::Laplacian(ScalarField^ sf)
+	{
+		if (NtInstance != NULL)
+		{
+			NtInstance->MultithreadLaplacian(sf->ArrayPointer, laplacian->ArrayPointer, sf->darray->Length);
+			return laplacian;
+		}
+		return NodeInterpolator::Laplacian(sf);
 	}
 
 
@@ -1257,7 +1424,6 @@ namespace Nt_ManifoldRing
 				{
 					idxminus = i + (j - 1) * m->NodesPerSide(0);
 					idxplus = toroidal ? i + 1 * m->NodesPerSide(0) : idxminus;
-					idxplus = idxminus;
 				}
 				else
 				{
@@ -1302,4 +1468,134 @@ namespace Nt_ManifoldRing
 		}
 		return sum * m->StepSize() * m->StepSize();
 	}
+
+
+	//********************************************
+	// implementation of Tricubic3D
+	//********************************************
+
+
+	void Tricubic3D::Init(InterpolatedNodes^ m, bool _toroidal)
+	{
+		NodeInterpolator::Init(m, _toroidal);
+		for (int i = 0; i < m->Dim; i++)
+		{
+			gradientOperator[i] = gcnew array<LocalMatrix>(NtTricubic3D::NUM_WEIGHTS);
+		}
+
+		int tmp[3];
+		tmp[0] = m->NodesPerSide(0);
+		tmp[1] = m->NodesPerSide(1);
+		tmp[2] = m->NodesPerSide(2);
+		if (NtInstance != NULL)delete NtInstance;
+		NtInstance = new NtTricubic3D(tmp, m->StepSize(), _toroidal);
+	}
+
+	double Tricubic3D::Interpolate(array<double>^ x, ScalarField^ sf)
+	{
+		pin_ptr<double> xptr = &x[0];
+		double *pos = xptr;
+		double output[4];
+		double *outptr = output;
+		NtInstance->NativeRestrict(sf->ArrayPointer, &pos, 1, &outptr);
+		return output[0];
+	}
+
+	array<double>^ Tricubic3D::Gradient(array<double>^ x, ScalarField^ sf)
+	{
+		pin_ptr<double> xptr = &x[0];
+		double *pos = xptr;
+		double output[4];
+		double *outptr = output;
+		NtInstance->NativeRestrict(sf->ArrayPointer, &pos, 1, &outptr);
+		gradient[0] = output[1];
+		gradient[1] = output[2];
+		gradient[2] = output[3];
+		return gradient;
+	}
+
+	void Tricubic3D::Restrict(ScalarField^ sf, double **position, int n, double **output)
+	{
+		NtInstance->MultithreadNativeRestrict(sf->ArrayPointer, position, n, output);
+	}
+
+	void Tricubic3D::Exchange(ScalarField^ sf, double **position, double *flux, int n, double **output)
+	{
+		NtInstance->NativeDepositFlux(position, flux, n, sf->ArrayPointer);
+		NtInstance->MultithreadNativeRestrict(sf->ArrayPointer, position, n, output);
+	}
+
+	double Tricubic3D::Integration(ScalarField^ sf)
+	{
+		return NtInstance->Integrate(sf->ArrayPointer);
+	}
+
+	array<LocalMatrix>^ Tricubic3D::interpolationMatrix(array<double>^ x)
+	{
+		pin_ptr<double> xptr = &x[0];
+		double *pos = xptr;
+		NtInstance->NativeWeights(&pos, 1, weightIndex, weightBuffer);
+		for (int i = 0; i < NtTricubic3D::NUM_WEIGHTS; i++)
+		{
+			interpolationOperator[i].Index = weightIndex[i];
+			interpolationOperator[i].Coefficient = weightBuffer[i];
+		}
+		return interpolationOperator;
+	}
+
+	array<array<LocalMatrix>^>^ Tricubic3D::gradientMatrix(array<double>^ x)
+	{
+		pin_ptr<double> xptr = &x[0];
+		double *pos = xptr;
+		NtInstance->NativeGradientWeights(&pos, 1, weightIndex, weightBuffer);
+		for (int d = 0; d < 3; d++)
+		{
+			array<LocalMatrix>^ lm = gradientOperator[d];
+			double *w = weightBuffer + d * NtTricubic3D::NUM_WEIGHTS;
+			for (int i = 0; i < NtTricubic3D::NUM_WEIGHTS; i++)
+			{
+				lm[i].Index = weightIndex[i];
+				lm[i].Coefficient = w[i];
+			}
+		}
+		return gradientOperator;
+	}
+
+	array<array<LocalMatrix>^>^ Tricubic3D::laplacianMatrix()
+	{
+		double coeff = 1.0 / (m->StepSize() * m->StepSize());
+		int N0 = m->NodesPerSide(0), N1 = m->NodesPerSide(1), N2 = m->NodesPerSide(2);
+		array<int>^ nps = gcnew array<int>{N0, N1, N2};
+		array<int>^ stride = gcnew array<int>{1, N0, N0 * N1};
+		array<int>^ ijk = gcnew array<int>(3);
+
+		int n = 0;
+		for (int k = 0; k < N2; k++)
+		{
+			for (int j = 0; j < N1; j++)
+			{
+				for (int i = 0; i < N0; i++)
+				{
+					ijk[0] = i;
+					ijk[1] = j;
+					ijk[2] = k;
+					laplacianOperator[n] = gcnew array<LocalMatrix>(7);
+					laplacianOperator[n][0].Index = n;
+					laplacianOperator[n][0].Coefficient = -6.0 * coeff;
+					for (int d = 0; d < 3; d++)
+					{
+						int c = ijk[d], last = nps[d] - 1;
+						int plus = c < last ? c + 1 : (toroidal ? 1 : c - 1);
+						int minus = c > 0 ? c - 1 : (toroidal ? last - 1 : c + 1);
+						laplacianOperator[n][2 * d + 1].Index = n + (plus - c) * stride[d];
+						laplacianOperator[n][2 * d + 1].Coefficient = coeff;
+						laplacianOperator[n][2 * d + 2].Index = n + (minus - c) * stride[d];
+						laplacianOperator[n][2 * d + 2].Coefficient = coeff;
+					}
+					n++;
+				}
+			}
+		}
+		return laplacianOperator;
+	}
 }
@@ -16,7 +16,10 @@ THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #pragma once
 
 #include "Nt_ManifoldUtilities.h"
-#include "NtInterpolation.h"
+#include "NtInterpolatedRectangle.h"
+#include "NtInterpolatedRectangularPrism.h"
+#include "NtSparseOperator.h"
+#include "NtTricubic3D.h"
 
 using namespace System;
 using namespace System::Collections::Generic;
@@ -84,13 +87,34 @@ namespace Nt_ManifoldRing
 		array<double>^ gradient;
 		ScalarField^ laplacian;
 
+		//laplacianOperator compiled to native, built on the first Laplacian() call
+		NtSparseOperator *NtLaplacian;
+
+		void compile_laplacian();
+
+		//laplacianOperator, built on first use. interpolators with a native
+		//Laplacian() never need it.
+		array<array<LocalMatrix>^>^ laplacian_operator();
+
 	public:
 		virtual double Integration(ScalarField^ sf) abstract;
 
 		NodeInterpolator()
         {
+			NtLaplacian = NULL;
         }
 
+		~NodeInterpolator()
+		{
+			this->!NodeInterpolator();
+		}
+
+		!NodeInterpolator()
+		{
+			if (NtLaplacian != NULL)delete NtLaplacian;
+			NtLaplacian = NULL;
+		}
+
 		virtual void Init(InterpolatedNodes^ m, bool _toroidal);
 
 
@@ -113,6 +137,14 @@ namespace Nt_ManifoldRing
         /// <returns></returns>
 		virtual ScalarField^ DiffusionFlux(ScalarField^ flux, Transform^ t, ScalarField^ dst, double dt);
 
+        /// <summary>
+        /// DiffusionFlux() for the fluxes of several surfaces, e.g. all cells of the ecs, added to the same dst.
+        /// </summary>
+        /// <param name="fluxes">Flux from each surface element of the volume</param>
+        /// <param name="t">Transform of each surface</param>
+        /// <returns></returns>
+		virtual ScalarField^ DiffusionFlux(array<ScalarField^>^ fluxes, array<Transform^>^ t, ScalarField^ dst, double dt);
+
          /// <summary>
         /// Return a scalar field (in the volume) representing the applied flux at a surface.
         /// Assigns the entire flux source to the closest node.
@@ -160,8 +192,21 @@ namespace Nt_ManifoldRing
         array<array<LocalMatrix>^>^ gradientOperatorJagged;
         array<int>^ idxarr;
 
-		//for unmanaged code
-		NtTrilinear3D *NtInstance;
+		//for unmanaged code, the restrict tables are shared with
+		//every prism on the same grid, see NtOperatorCache
+		NtInterpolatedRectangularPrism *NtInstance;
+
+		//native positions and source terms of the flux principal points, see DiffusionFlux()
+		double *depositPosition;
+		double **depositPointer;
+		double *depositFlux;
+		int depositCapacity;
+
+		//grow the deposit buffers to n points
+		void reserveDeposit(int n);
+
+		//append the principal points of flux at q, returns the next free slot
+		int gatherFlux(ScalarField^ flux, Transform^ t, double dt, int q);
 
 
 	public:
@@ -169,6 +214,10 @@ namespace Nt_ManifoldRing
         {
             interpolationOperator = gcnew array<LocalMatrix>(8);
 			NtInstance = NULL;
+			depositPosition = NULL;
+			depositPointer = NULL;
+			depositFlux = NULL;
+			depositCapacity = 0;
         }
 
 		~Trilinear3D()
@@ -179,10 +228,24 @@ namespace Nt_ManifoldRing
 		!Trilinear3D()
 		{
 			if (NtInstance != NULL)delete NtInstance;
+			NtInstance = NULL;
+			free(depositPosition);
+			free(depositPointer);
+			free(depositFlux);
+			depositPosition = NULL;
+			depositPointer = NULL;
+			depositFlux = NULL;
+			depositCapacity = 0;
 		}
 
 		virtual void Init(InterpolatedNodes^ m, bool _toroidal) override;
 
+		//native scatter of the principal points, same result as NodeInterpolator::DiffusionFlux()
+		virtual ScalarField^ DiffusionFlux(ScalarField^ flux, Transform^ t, ScalarField^ dst, double dt) override;
+
+		//all principal points in one multithreaded native pass
+		virtual ScalarField^ DiffusionFlux(array<ScalarField^>^ fluxes, array<Transform^>^ t, ScalarField^ dst, double dt) override;
+
 	protected:
         // Don't need to account for toroidal BCs with this low-order scheme. 
 		virtual array<LocalMatrix>^ interpolationMatrix(array<double>^ x) override;
@@ -208,13 +271,27 @@ namespace Nt_ManifoldRing
     /// </summary>
     public ref class Trilinear2D : NodeInterpolator
     {
+		//for unmanaged code
+		NtInterpolatedRectangle *NtInstance;
 
 	public:
 		Trilinear2D(): NodeInterpolator()
         {
             interpolationOperator = gcnew array<LocalMatrix>(4);
+			NtInstance = NULL;
         }
 
+		~Trilinear2D()
+		{
+			this->!Trilinear2D();
+		}
+
+		!Trilinear2D()
+		{
+			if (NtInstance != NULL)delete NtInstance;
+			NtInstance = NULL;
+		}
+
 		virtual void Init(InterpolatedNodes^ m, bool _toroidal) override;
 
 	protected:
@@ -229,6 +306,12 @@ namespace Nt_ManifoldRing
 		
 	public:
 		virtual double Integration(ScalarField^ sf) override;
+
+		virtual double Interpolate(array<double>^ x, ScalarField^ sf) override;
+
+		virtual array<double>^ Gradient(array<double>^ x, ScalarField^ sf) override;
+
+		virtual ScalarField^ Laplacian(ScalarField^ sf) override;
     };
 
 
@@ -240,43 +323,59 @@ namespace Nt_ManifoldRing
     /// <returns></returns>
     public ref class Tricubic3D : NodeInterpolator
     {
+		//for unmanaged code
+		NtTricubic3D *NtInstance;
+		//native scratch for one position, see interpolationMatrix() and gradientMatrix()
+		int *weightIndex;
+		double *weightBuffer;
+
 	public:
-		Tricubic3D()
-            : NodeInterpolator()
+		Tricubic3D() : NodeInterpolator()
         {
-            throw gcnew NotImplementedException();
-            // interpolator = gcnew LocalMatrix[27];
+            interpolationOperator = gcnew array<LocalMatrix>(NtTricubic3D::NUM_WEIGHTS);
+			NtInstance = NULL;
+			weightIndex = (int *)malloc(NtTricubic3D::NUM_WEIGHTS * sizeof(int));
+			weightBuffer = (double *)malloc(3 * NtTricubic3D::NUM_WEIGHTS * sizeof(double));
         }
 
-		virtual void Init(InterpolatedNodes^ m, bool _toroidal) override
-        {
-            NodeInterpolator::Init(m, _toroidal);
-        }
+		~Tricubic3D()
+		{
+			this->!Tricubic3D();
+		}
 
-		virtual double Integration(ScalarField^ sf) override
-        {
-            throw gcnew NotImplementedException();
-        }
+		!Tricubic3D()
+		{
+			if (NtInstance != NULL)delete NtInstance;
+			NtInstance = NULL;
+			free(weightIndex);
+			free(weightBuffer);
+			weightIndex = NULL;
+			weightBuffer = NULL;
+		}
+
+		virtual void Init(InterpolatedNodes^ m, bool _toroidal) override;
+
+		virtual double Integration(ScalarField^ sf) override;
+
+		virtual double Interpolate(array<double>^ x, ScalarField^ sf) override;
+
+		virtual array<double>^ Gradient(array<double>^ x, ScalarField^ sf) override;
+
+		//batch value and gradient for n positions, output[p] holds value, d/dx, d/dy, d/dz
+		void Restrict(ScalarField^ sf, double **position, int n, double **output);
+
+		//deposit the flux sources at n positions into sf, then Restrict() at the same positions
+		void Exchange(ScalarField^ sf, double **position, double *flux, int n, double **output);
 
 	protected:
 
-		virtual array<LocalMatrix>^ interpolationMatrix(array<double>^ x) override
-        {
-            throw gcnew NotImplementedException();
-            //return interpolator;
-        }
+		virtual array<LocalMatrix>^ interpolationMatrix(array<double>^ x) override;
 
-		virtual array<array<LocalMatrix>^>^ gradientMatrix(array<double>^ x) override
-        {
-            throw gcnew NotImplementedException();
-            //return gradient;
-        }
+		virtual array<array<LocalMatrix>^>^ gradientMatrix(array<double>^ x) override;
 
-		virtual array<array<LocalMatrix>^>^ laplacianMatrix() override
-        {
-            throw gcnew NotImplementedException();
-            // return laplacian;
-        }
+		//nodal values are interpolated exactly, so the nodal laplacian is the
+		//same 7 point stencil as Trilinear3D
+		virtual array<array<LocalMatrix>^>^ laplacianMatrix() override;
     };
     
     /// <summary>
@@ -472,6 +472,11 @@ namespace Nt_ManifoldRing
 		return interpolator->DiffusionFlux(flux, t, sf, dt);
 	}
 
+	ScalarField^ InterpolatedNodes::DiffusionFluxTerm(array<ScalarField^>^ fluxes, array<Transform^>^ t, ScalarField^ sf, double dt) 
+	{
+		return interpolator->DiffusionFlux(fluxes, t, sf, dt);
+	}
+
 	/// <summary>
 	/// Impose Dirichlet boundary conditions
 	/// </summary>
@@ -554,6 +559,12 @@ namespace Nt_ManifoldRing
 	/// <returns>integral value</returns>
 	double InterpolatedRectangularPrism::Integrate(ScalarField^ sf) 
 	{
+		// same voxel center sum, done natively
+		if (dynamic_cast<Trilinear3D^>(interpolator) != nullptr)
+		{
+			return interpolator->Integration(sf);
+		}
+
 		array<double>^ point = gcnew array<double>(3);
 		double sum = 0,
 			voxel = stepSize * stepSize * stepSize;
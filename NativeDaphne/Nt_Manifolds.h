@@ -611,6 +611,17 @@ namespace Nt_ManifoldRing
             this->interpolator = interpolator;
         }
 
+        /// <summary>
+        /// the interpolator instance used
+        /// </summary>
+        property Interpolator^ Interp
+        {
+            Interpolator^ get()
+            {
+                return interpolator;
+            }
+        }
+
         /// <summary>
         /// initialize the nodes per side and stepsize members
         /// </summary>
@@ -847,6 +858,9 @@ namespace Nt_ManifoldRing
 
         virtual ScalarField^ DiffusionFluxTerm(ScalarField^ flux, Transform^ t, ScalarField^ sf, double dt) override;
 
+        //DiffusionFluxTerm() for the fluxes of several boundary manifolds in one pass
+        ScalarField^ DiffusionFluxTerm(array<ScalarField^>^ fluxes, array<Transform^>^ t, ScalarField^ sf, double dt);
+
 
         /// <summary>
         /// Impose Dirichlet boundary conditions
@@ -44,8 +44,12 @@ namespace NativeDaphne
 		BoundaryConcAndFlux = gcnew Dictionary<int, Nt_MolecluarPopulationBoundary^>();
 		ComponentBoundaryConcAndFlux = gcnew Dictionary<int, Nt_MolecluarPopulationBoundary^>();
 		parent = nullptr;
-		_laplacian = NULL;
 		_boundaryConcPtrs = NULL;
+		_boundaryFluxPtrs = NULL;
+		_boundaryFluxLength = NULL;
+		_boundaryFluxArea = NULL;
+		_boundarySource = NULL;
+		boundaryExchanged = false;
 	}
 
 	Nt_MolecularPopulation^ Nt_MolecularPopulation::CloneParent(Nt_Compartment^ c)
@@ -68,8 +72,12 @@ namespace NativeDaphne
 		DiffusionCoefficient = _diffusionCoefficient;
 		concentration = conc;
 		parent = nullptr;
-		_laplacian = NULL;
 		_boundaryConcPtrs = NULL;
+		_boundaryFluxPtrs = NULL;
+		_boundaryFluxLength = NULL;
+		_boundaryFluxArea = NULL;
+		_boundarySource = NULL;
+		boundaryExchanged = false;
 	}
 
 	void Nt_MolecularPopulation::step(double dt)
@@ -103,8 +111,13 @@ namespace NativeDaphne
 		if (IsDiffusing == true)
 		{
 			//concentration->Add(concentration->Laplacian()->Multiply(dt * DiffusionCoefficient));
-			ScalarField^ laplacian = concentration->Laplacian();
-			daxpy(concentration->darray->Length, dt * DiffusionCoefficient, laplacian->ArrayPointer, 1, concentration->ArrayPointer, 1);
+			double radius = cytosol->CellRadius;
+			int nsub = DiffusionSubsteps(dt, radius * radius / (5 * DiffusionCoefficient));
+			for (int i = 0; i < nsub; i++)
+			{
+				ScalarField^ laplacian = concentration->Laplacian();
+				daxpy(concentration->darray->Length, dt * DiffusionCoefficient / nsub, laplacian->ArrayPointer, 1, concentration->ArrayPointer, 1);
+			}
 		}
 
 		//handle diffusion flux terms, cytosol has only one boundary plasma membrane
@@ -171,27 +184,85 @@ namespace NativeDaphne
 	{
 		if (IsDiffusing == true)
 		{
-			//note: this is the generic approach, we can implement specialized laplacian for ecs
-			//to speed this up.
-			ScalarField^ laplacian = concentration->Laplacian();
-			daxpy(concentration->darray->Length, dt * DiffusionCoefficient, laplacian->ArrayPointer, 1, concentration->ArrayPointer, 1);
-			//concentration->Add(concentration->Laplacian()->Multiply(dt * DiffusionCoefficient));
+			NtInterpolatedRectangularPrism *ir_prism = ECS->ir_prism;
+			double alpha = dt * DiffusionCoefficient;
+			switch (ECS->DiffusionScheme)
+			{
+			case Nt_DiffusionScheme::CrankNicolson:
+				ir_prism->DiffuseImplicit(ConcPointer, alpha, 0.5);
+				break;
+			case Nt_DiffusionScheme::BackwardEuler:
+				ir_prism->DiffuseImplicit(ConcPointer, alpha, 1.0);
+				break;
+			case Nt_DiffusionScheme::Spectral:
+				if (ECS->IsToroidal == false)
+				{
+					throw gcnew Exception("Spectral diffusion requires a toroidal ECS");
+				}
+				ir_prism->DiffuseSpectral(ConcPointer, alpha);
+				break;
+			default:
+				{
+					//in place stencil update, no laplacian array needed
+					//the substeps are advanced together, see DiffuseSteps
+					int nsub = DiffusionSubsteps(dt, ECS->StepSize * ECS->StepSize / (6 * DiffusionCoefficient));
+					ir_prism->DiffuseSteps(ConcPointer, alpha / nsub, nsub);
+				}
+				break;
+			}
 		}		
 	}
 
 	//update boundary for ECS
 	void Nt_MolecularPopulation::UpdateBoundary(Nt_ECS^ ECS)
 	{
+		//already restricted by ExchangeBoundary()
+		if (boundaryExchanged == true)
+		{
+			boundaryExchanged = false;
+			return;
+		}
+
 		//this is the speed up version
 		NtInterpolatedRectangularPrism *ir_prism = ECS->ir_prism;
 		double *sfarray = this->ConcPointer;
 		int item_count = ECS->BoundaryKeys->Count;
 		
+		if (ECS->tricubic != nullptr)
+		{
+			ECS->tricubic->Restrict(concentration, ECS->Positions, item_count, _boundaryConcPtrs);
+			return;
+		}
+
 		//ir_prism->NativeRestrict(sfarray, ECS->Positions, item_count, _boundaryConcPtrs);
 		//multithread version
 		ir_prism->MultithreadNativeRestrict(sfarray, ECS->Positions, item_count, _boundaryConcPtrs);
 	}
 
+	//same source term as NodeInterpolator::DiffusionFlux(), the cell boundaries
+	//are moment expansions with the single principal point at the cell position
+	void Nt_MolecularPopulation::ExchangeBoundary(Nt_ECS^ ECS, double dt)
+	{
+		NtInterpolatedRectangularPrism *ir_prism = ECS->ir_prism;
+		int item_count = ECS->BoundaryKeys->Count;
+		double scale = -dt / manifold->VoxelVolume();
+		for (int i=0; i< item_count; i++)
+		{
+			double *flux = _boundaryFluxPtrs[i];
+			_boundarySource[i] = _boundaryFluxArea[i] * flux[0] * scale;
+			memset(flux, 0, _boundaryFluxLength[i] * sizeof(double));
+		}
+		if (ECS->tricubic != nullptr)
+		{
+			ECS->tricubic->Exchange(concentration, ECS->Positions, _boundarySource, item_count, _boundaryConcPtrs);
+		}
+		else
+		{
+			ir_prism->MultithreadExchange(ConcPointer, ECS->Positions, _boundarySource, item_count, _boundaryConcPtrs);
+		}
+		boundaryExchanged = true;
+	}
+
 	void Nt_MolecularPopulation::AddMolecularPopulation(Nt_MolecularPopulation^ molpop)
 	{
 
@@ -199,13 +270,6 @@ namespace NativeDaphne
 		molpop->parent = this;
 		ComponentPopulations->Add(molpop);
 
-		int len = molpop->Conc->darray->Length;
-		if (_laplacian != NULL)
-		{
-			int y = 1;
-		}
-		_laplacian = (double *)realloc(_laplacian, molpop->Conc->darray->Length);
-
 		//merge boundaries, this should only be needed for cells.
 		if (molpop->BoundaryConcAndFlux->Count > 0)
 		{
@@ -387,12 +451,14 @@ namespace NativeDaphne
 
 		//this is to ensure that cell transoform and bouanaryConc are in same order
 		Dictionary<int, Nt_Darray^>^ boundaryConcDict = gcnew Dictionary<int, Nt_Darray^>();
+		Dictionary<int, ScalarField^>^ boundaryFluxDict = gcnew Dictionary<int, ScalarField^>();
 		for each (KeyValuePair<int, Nt_MolecluarPopulationBoundary^>^ kvp in BoundaryConcAndFlux)
 		{
 			Nt_MolecluarPopulationBoundary^ boundary = kvp->Value;
 			if (boundary->IsContainer() == false)
 			{
 				boundaryConcDict->Add(boundary->BoundaryId, boundary->Conc->darray);
+				boundaryFluxDict->Add(boundary->BoundaryId, boundary->Flux);
 			}
 			else 
 			{
@@ -400,6 +466,7 @@ namespace NativeDaphne
 				for (int i=0; i< Component->Count; i++)
 				{
 					boundaryConcDict->Add(Component[i]->BoundaryId, Component[i]->Conc->darray);
+					boundaryFluxDict->Add(Component[i]->BoundaryId, Component[i]->Flux);
 				}
 			}
 		}
@@ -415,6 +482,20 @@ namespace NativeDaphne
 			int key = BoundaryKeys[i];
 			_boundaryConcPtrs[i] = boundaryConcDict[key]->NativePointer;
 		}
+
+		int count = BoundaryKeys->Count;
+		_boundaryFluxPtrs = (double **)realloc(_boundaryFluxPtrs, count * sizeof(double *));
+		_boundaryFluxLength = (int *)realloc(_boundaryFluxLength, count * sizeof(int));
+		_boundaryFluxArea = (double *)realloc(_boundaryFluxArea, count * sizeof(double));
+		_boundarySource = (double *)realloc(_boundarySource, count * sizeof(double));
+		for (int i=0; i< count; i++)
+		{
+			ScalarField^ flux = boundaryFluxDict[BoundaryKeys[i]];
+			_boundaryFluxPtrs[i] = flux->ArrayPointer;
+			_boundaryFluxLength[i] = flux->darray->Length;
+			_boundaryFluxArea[i] = flux->M->Area();
+		}
+		boundaryExchanged = false;
 	}
 
 }
\ No newline at end of file
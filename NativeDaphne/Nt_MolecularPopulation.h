@@ -165,8 +165,24 @@ namespace NativeDaphne
 		//this exist only for help debug
 		String^ Name;
 		double DiffusionCoefficient;
+
+		//number of explicit diffusion substeps for a step dt, given the stable
+		//explicit step of this population on its manifold.
+		int DiffusionSubsteps(double dt, double stable_step)
+		{
+			if (SubcycleDiffusion == false || dt <= stable_step * SubcycleSafety)return 1;
+			return (int)Math::Ceiling(dt / (stable_step * SubcycleSafety));
+		}
 	public:
 
+		//when true, each population diffuses with substeps no larger than its own
+		//stable explicit step (h^2/6D in the ecs, r^2/5D in the cytosol), so the
+		//simulation step is not bound by the fastest diffuser. slow species still
+		//diffuse once per step. reactions and diffusion are split as before.
+		//on by default, without it a step above the stable step is unstable.
+		static bool SubcycleDiffusion = true;
+		static double SubcycleSafety = 0.9;
+
 		//molecule identity
 		String^ MoleculeKey;
 
@@ -240,6 +256,11 @@ namespace NativeDaphne
 		void initialize(Nt_ECS^ ecs);
 		void UpdateBoundary(Nt_ECS^ ECS);
 
+		//deposit the cell boundary fluxes into the ecs and restrict the new boundary
+		//concentrations in one native pass, the fluxes are reset. the following
+		//UpdateBoundary() is skipped, the concentration must not change in between.
+		void ExchangeBoundary(Nt_ECS^ ECS, double dt);
+
 		Nt_Compartment^ Compartment;
 
 	internal:
@@ -265,9 +286,16 @@ namespace NativeDaphne
 		}
 		
 	protected:
-		double *_laplacian;				
 		//for cells in ecs
 		double **_boundaryConcPtrs;
+		//flux arrays of the cells, their length and the area of the cell boundary
+		double **_boundaryFluxPtrs;
+		int *_boundaryFluxLength;
+		double *_boundaryFluxArea;
+		//flux source terms for ExchangeBoundary()
+		double *_boundarySource;
+		//set by ExchangeBoundary(), cleared by UpdateBoundary()
+		bool boundaryExchanged;
 		bool initialized;
 	};
 
@@ -143,6 +143,20 @@ namespace Nt_ManifoldRing
 		return m->DiffusionFluxTerm(flux, t, this, dt);
 	}
 
+	ScalarField^ ScalarField::DiffusionFluxTerm(array<ScalarField^>^ fluxes, array<Transform^>^ t, double dt)
+	{
+		InterpolatedNodes^ im = dynamic_cast<InterpolatedNodes^>(m);
+		if (im != nullptr)
+		{
+			return im->DiffusionFluxTerm(fluxes, t, this, dt);
+		}
+		for (int i = 0; i < fluxes->Length; i++)
+		{
+			m->DiffusionFluxTerm(fluxes[i], t[i], this, dt);
+		}
+		return this;
+	}
+
 	/// <summary>
 	/// integrate the field
 	/// </summary>
@@ -494,6 +494,15 @@ namespace Nt_ManifoldRing
         /// <returns>diffusion flux term as field in the interior manifold</returns>
 		ScalarField^ DiffusionFluxTerm(ScalarField^ flux, Transform^ t, double dt);
 
+        /// <summary>
+        /// field diffusion flux term for several boundary manifolds,
+        /// done in one native pass on interpolated node manifolds
+        /// </summary>
+        /// <param name="fluxes">flux from each boundary manifold</param>
+        /// <param name="t">Transform of each boundary manifold</param>
+        /// <returns>diffusion flux term as field in the interior manifold</returns>
+		ScalarField^ DiffusionFluxTerm(array<ScalarField^>^ fluxes, array<Transform^>^ t, double dt);
+
         /// <summary>
         /// integrate the field
         /// </summary>
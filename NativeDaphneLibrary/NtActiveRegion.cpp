@@ -0,0 +1,360 @@
+/*
+Copyright (C) 2019 Kepler Laboratory of Quantitative Immunology
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY 
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH 
+THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "stdafx.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "NtActiveRegion.h"
+
+namespace NativeDaphneLibrary
+{
+	NtActiveRegion::NtActiveRegion(int* extents, bool toroidal, double tolerance)
+	{
+		isToroidal = toroidal;
+		Tolerance = tolerance;
+		TileCount = 1;
+		for (int d = 0; d < 3; d++)
+		{
+			NodesPerSide[d] = extents[d];
+			Tiles[d] = (extents[d] + TILE_SIZE - 1) / TILE_SIZE;
+			TileCount *= Tiles[d];
+		}
+		NPS01 = extents[0] * extents[1];
+
+		uniform = (unsigned char *)malloc(TileCount);
+		pending = (unsigned char *)malloc(TileCount);
+		listed = (unsigned char *)malloc(TileCount);
+		memset(uniform, 0, TileCount);
+		memset(pending, 0, TileCount);
+		memset(listed, 0, TileCount);
+		pendingTiles = (int *)malloc(TileCount * sizeof(int));
+		ActiveTiles = (int *)malloc(TileCount * sizeof(int));
+		pendingCount = 0;
+		ActiveCount = 0;
+		tileBuffer = NULL;
+		tileBufferTiles = 0;
+
+		//nothing is known about the field yet
+		MarkAll();
+	}
+
+	NtActiveRegion::~NtActiveRegion()
+	{
+		free(uniform);
+		free(pending);
+		free(listed);
+		free(pendingTiles);
+		free(ActiveTiles);
+		if (tileBuffer != NULL)
+		{
+			_aligned_free(tileBuffer);
+		}
+	}
+
+	void NtActiveRegion::tile_bounds(int t, int *lo, int *hi)
+	{
+		int tc[3];
+		tc[0] = t % Tiles[0];
+		tc[1] = (t / Tiles[0]) % Tiles[1];
+		tc[2] = t / (Tiles[0] * Tiles[1]);
+		for (int d = 0; d < 3; d++)
+		{
+			lo[d] = tc[d] * TILE_SIZE;
+			hi[d] = lo[d] + TILE_SIZE;
+			if (hi[d] > NodesPerSide[d])hi[d] = NodesPerSide[d];
+		}
+	}
+
+	//node i is read by nodes i-1 and i+1, and for toroidal grids node 1 is also read by
+	//node N-1 and node N-2 by node 0.
+	int NtActiveRegion::affected_tiles(int d, int lo, int hi, int *tiles)
+	{
+		int n = NodesPerSide[d];
+		int t0 = (lo > 0 ? lo - 1 : 0) / TILE_SIZE;
+		int t1 = (hi < n - 1 ? hi + 1 : n - 1) / TILE_SIZE;
+		int count = 0;
+		for (int t = t0; t <= t1; t++)
+		{
+			tiles[count++] = t;
+		}
+		if (isToroidal)
+		{
+			if (lo <= 1 && hi >= 1 && t1 < Tiles[d] - 1)tiles[count++] = Tiles[d] - 1;
+			if (lo <= n - 2 && hi >= n - 2 && t0 > 0)tiles[count++] = 0;
+		}
+		return count;
+	}
+
+	void NtActiveRegion::MarkNodes(int *lo, int *hi)
+	{
+		int tiles[3][TILE_SIZE + 4];
+		int count[3];
+		for (int d = 0; d < 3; d++)
+		{
+			int l = lo[d] < 0 ? 0 : lo[d];
+			int h = hi[d] > NodesPerSide[d] - 1 ? NodesPerSide[d] - 1 : hi[d];
+			if (l > h)return;
+			//a box can span many tiles, mark them in chunks
+			if (h - l > TILE_SIZE)
+			{
+				int mid[3], mid_hi[3];
+				for (int e = 0; e < 3; e++)
+				{
+					mid[e] = lo[e];
+					mid_hi[e] = hi[e];
+				}
+				mid_hi[d] = l + TILE_SIZE - 1;
+				MarkNodes(mid, mid_hi);
+				mid[d] = l + TILE_SIZE;
+				mid_hi[d] = h;
+				MarkNodes(mid, mid_hi);
+				return;
+			}
+			count[d] = affected_tiles(d, l, h, tiles[d]);
+		}
+		for (int c = 0; c < count[2]; c++)
+		{
+			for (int b = 0; b < count[1]; b++)
+			{
+				for (int a = 0; a < count[0]; a++)
+				{
+					int t = tiles[0][a] + (tiles[1][b] + tiles[2][c] * Tiles[1]) * Tiles[0];
+					if (pending[t] == 0)
+					{
+						pending[t] = 1;
+						pendingTiles[pendingCount++] = t;
+					}
+				}
+			}
+		}
+	}
+
+	//the interpolation stencil (up to tricubic) spans nodes floor(x/h) - 1 to floor(x/h) + 2
+	void NtActiveRegion::MarkPosition(double *x, double step_size)
+	{
+		int lo[3], hi[3];
+		for (int d = 0; d < 3; d++)
+		{
+			int i = (int)floor(x[d] / step_size);
+			lo[d] = i - 1;
+			hi[d] = i + 2;
+		}
+		MarkNodes(lo, hi);
+	}
+
+	void NtActiveRegion::MarkBoundary()
+	{
+		for (int d = 0; d < 3; d++)
+		{
+			int lo[3] = {0, 0, 0};
+			int hi[3] = {NodesPerSide[0] - 1, NodesPerSide[1] - 1, NodesPerSide[2] - 1};
+			hi[d] = 0;
+			MarkNodes(lo, hi);
+			lo[d] = hi[d] = NodesPerSide[d] - 1;
+			MarkNodes(lo, hi);
+		}
+	}
+
+	void NtActiveRegion::MarkAll()
+	{
+		for (int t = 0; t < TileCount; t++)
+		{
+			if (pending[t] == 0)
+			{
+				pending[t] = 1;
+				pendingTiles[pendingCount++] = t;
+			}
+		}
+	}
+
+	void NtActiveRegion::MarkActiveOf(NtActiveRegion *other)
+	{
+		int lo[3], hi[3];
+		for (int n = 0; n < other->ActiveCount; n++)
+		{
+			tile_bounds(other->ActiveTiles[n], lo, hi);
+			for (int d = 0; d < 3; d++)hi[d]--;
+			MarkNodes(lo, hi);
+		}
+	}
+
+	void NtActiveRegion::MarkChanged()
+	{
+		MarkActiveOf(this);
+	}
+
+	bool NtActiveRegion::is_uniform(const double *sfarray, int t)
+	{
+		int lo[3], hi[3];
+		tile_bounds(t, lo, hi);
+		//node lists of the tile and its halo along each direction
+		int idx[3][TILE_SIZE + 2];
+		int len[3];
+		for (int d = 0; d < 3; d++)
+		{
+			int n = 0;
+			idx[d][n++] = minus(d, lo[d]);
+			for (int i = lo[d]; i < hi[d]; i++)
+			{
+				idx[d][n++] = i;
+			}
+			idx[d][n++] = plus(d, hi[d] - 1);
+			len[d] = n;
+		}
+		double vmin = sfarray[lo[0] + lo[1] * NodesPerSide[0] + lo[2] * NPS01];
+		double vmax = vmin;
+		for (int c = 0; c < len[2]; c++)
+		{
+			for (int b = 0; b < len[1]; b++)
+			{
+				const double *row = sfarray + idx[1][b] * NodesPerSide[0] + idx[2][c] * NPS01;
+				for (int a = 0; a < len[0]; a++)
+				{
+					double v = row[idx[0][a]];
+					if (v < vmin)vmin = v;
+					if (v > vmax)vmax = v;
+				}
+			}
+			if (vmax - vmin > Tolerance)return false;
+		}
+		return true;
+	}
+
+	//for toroidal grids node N-1 is node 0, a tile on the first layer and its image on the last
+	//layer are always updated together so the copies stay identical.
+	void NtActiveRegion::add_active(int t)
+	{
+		int tc[3];
+		tc[0] = t % Tiles[0];
+		tc[1] = (t / Tiles[0]) % Tiles[1];
+		tc[2] = t / (Tiles[0] * Tiles[1]);
+		int alt[3][2];
+		int nalt[3];
+		for (int d = 0; d < 3; d++)
+		{
+			alt[d][0] = tc[d];
+			nalt[d] = 1;
+			if (isToroidal && Tiles[d] > 1)
+			{
+				if (tc[d] == 0)alt[d][nalt[d]++] = Tiles[d] - 1;
+				else if (tc[d] == Tiles[d] - 1)alt[d][nalt[d]++] = 0;
+			}
+		}
+		for (int c = 0; c < nalt[2]; c++)
+		{
+			for (int b = 0; b < nalt[1]; b++)
+			{
+				for (int a = 0; a < nalt[0]; a++)
+				{
+					int s = alt[0][a] + (alt[1][b] + alt[2][c] * Tiles[1]) * Tiles[0];
+					if (listed[s] == 0)
+					{
+						listed[s] = 1;
+						ActiveTiles[ActiveCount++] = s;
+					}
+				}
+			}
+		}
+	}
+
+	int NtActiveRegion::Update(double *sfarray)
+	{
+		for (int n = 0; n < pendingCount; n++)
+		{
+			int t = pendingTiles[n];
+			uniform[t] = is_uniform(sfarray, t) ? 1 : 0;
+			pending[t] = 0;
+		}
+		pendingCount = 0;
+
+		for (int n = 0; n < ActiveCount; n++)
+		{
+			listed[ActiveTiles[n]] = 0;
+		}
+		ActiveCount = 0;
+		for (int t = 0; t < TileCount; t++)
+		{
+			if (uniform[t] == 0)add_active(t);
+		}
+		return ActiveCount;
+	}
+
+	double *NtActiveRegion::TileBuffer()
+	{
+		if (ActiveCount > tileBufferTiles)
+		{
+			if (tileBuffer != NULL)_aligned_free(tileBuffer);
+			tileBufferTiles = ActiveCount;
+			tileBuffer = (double *)_aligned_malloc(tileBufferTiles * TILE_NODES * sizeof(double), 32);
+		}
+		return tileBuffer;
+	}
+
+	void NtActiveRegion::DiffuseTiles(const double *sfarray, int first, int last, double w0, double w1, double *out)
+	{
+		int lo[3], hi[3];
+		int xm[TILE_SIZE], xp[TILE_SIZE];
+		for (int n = first; n < last; n++)
+		{
+			tile_bounds(ActiveTiles[n], lo, hi);
+			double *dst = out + n * TILE_NODES;
+			int nx = hi[0] - lo[0];
+			for (int i = 0; i < nx; i++)
+			{
+				xm[i] = minus(0, lo[0] + i);
+				xp[i] = plus(0, lo[0] + i);
+			}
+			for (int k = lo[2]; k < hi[2]; k++)
+			{
+				const double *plane = sfarray + k * NPS01;
+				const double *zm = sfarray + minus(2, k) * NPS01;
+				const double *zp = sfarray + plus(2, k) * NPS01;
+				for (int j = lo[1]; j < hi[1]; j++)
+				{
+					int row = j * NodesPerSide[0];
+					const double *c = plane + row;
+					const double *ym = plane + minus(1, j) * NodesPerSide[0];
+					const double *yp = plane + plus(1, j) * NodesPerSide[0];
+					for (int i = 0; i < nx; i++)
+					{
+						int ii = lo[0] + i;
+						dst[i] = w0 * c[ii] + w1 * (c[xp[i]] + c[xm[i]] + yp[ii] + ym[ii] + zp[row + ii] + zm[row + ii]);
+					}
+					dst += nx;
+				}
+			}
+		}
+	}
+
+	void NtActiveRegion::WriteTiles(double *sfarray, int first, int last, const double *in)
+	{
+		int lo[3], hi[3];
+		for (int n = first; n < last; n++)
+		{
+			tile_bounds(ActiveTiles[n], lo, hi);
+			const double *src = in + n * TILE_NODES;
+			int nx = hi[0] - lo[0];
+			for (int k = lo[2]; k < hi[2]; k++)
+			{
+				for (int j = lo[1]; j < hi[1]; j++)
+				{
+					memcpy(sfarray + lo[0] + j * NodesPerSide[0] + k * NPS01, src, nx * sizeof(double));
+					src += nx;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,121 @@
+/*
+Copyright (C) 2019 Kepler Laboratory of Quantitative Immunology
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY 
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH 
+THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+
+#ifdef COMPILE_FLAG
+#define DllExport __declspec(dllexport)
+#else 
+#define DllExport __declspec(dllimport)
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+
+namespace NativeDaphneLibrary
+{
+	//active tile tracking for one species on the ecs grid, see NtInterpolatedRectangularPrism::DiffuseActive.
+	//the grid is split into TILE_SIZE^3 tiles. a tile is uniform when the values over the tile and its
+	//one node halo are within Tolerance of each other, the stencil then leaves it (nearly) unchanged and
+	//the tile is skipped.
+	//only tiles whose halo region was changed are re-evaluated: the tiles near the active tiles after
+	//each step, and those marked for outside changes (boundary flux, reactions).
+	class DllExport NtActiveRegion
+	{
+	public:
+
+		static const int TILE_SIZE = 8;
+		static const int TILE_NODES = TILE_SIZE * TILE_SIZE * TILE_SIZE;
+
+		NtActiveRegion(int* extents, bool toroidal, double tolerance);
+
+		~NtActiveRegion();
+
+		double Tolerance;
+
+		//tiles to be updated, valid after Update()
+		int ActiveCount;
+		int *ActiveTiles;
+
+		//re-evaluate the marked tiles and rebuild the active list, returns ActiveCount
+		int Update(double *sfarray);
+
+		//mark the tiles whose halo region contains nodes [lo, hi] (inclusive) as changed
+		void MarkNodes(int *lo, int *hi);
+
+		//mark the interpolation nodes around a position, e.g. where a cell deposits flux
+		void MarkPosition(double *x, double step_size);
+
+		//mark the tiles on the faces of the grid, where the natural boundary conditions apply
+		void MarkBoundary();
+
+		//mark all tiles, needed when the field is changed from outside
+		void MarkAll();
+
+		//mark the neighbourhood of the active tiles of other, for species coupled through reactions
+		void MarkActiveOf(NtActiveRegion *other);
+
+		//mark the neighbourhood of the active tiles after they were updated
+		void MarkChanged();
+
+		//stencil update of active tiles [first, last) into out, TILE_NODES values per tile
+		void DiffuseTiles(const double *sfarray, int first, int last, double w0, double w1, double *out);
+
+		//copy the values computed by DiffuseTiles() back
+		void WriteTiles(double *sfarray, int first, int last, const double *in);
+
+		//buffer for DiffuseTiles(), TILE_NODES values for each active tile
+		double *TileBuffer();
+
+	private:
+
+		int NodesPerSide[3];
+		int NPS01;
+		int Tiles[3];
+		int TileCount;
+		bool isToroidal;
+
+		//per tile flags
+		unsigned char *uniform;
+		unsigned char *pending;
+		unsigned char *listed;
+
+		int *pendingTiles;
+		int pendingCount;
+
+		double *tileBuffer;
+		int tileBufferTiles;
+
+		int minus(int d, int i)
+		{
+			return i > 0 ? i - 1 : (isToroidal ? NodesPerSide[d] - 2 : 1);
+		}
+
+		int plus(int d, int i)
+		{
+			return i < NodesPerSide[d] - 1 ? i + 1 : (isToroidal ? 1 : NodesPerSide[d] - 2);
+		}
+
+		//node range [lo, hi) of tile t
+		void tile_bounds(int t, int *lo, int *hi);
+
+		//tiles along direction d whose halo region contains one of the nodes [lo, hi]
+		int affected_tiles(int d, int lo, int hi, int *tiles);
+
+		bool is_uniform(const double *sfarray, int t);
+
+		void add_active(int t);
+	};
+}
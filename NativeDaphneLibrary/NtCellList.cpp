@@ -0,0 +1,229 @@
+/*
+Copyright (C) 2019 Kepler Laboratory of Quantitative Immunology
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY 
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH 
+THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "stdafx.h"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <stdexcept>
+
+#include "NtUtility.h"
+#include "NtCellList.h"
+
+namespace NativeDaphneLibrary
+{
+
+	NtCellList::NtCellList(int *_gridPts, bool _isToroidal)
+	{
+		gridPts[0] = _gridPts[0];
+		gridPts[1] = _gridPts[1];
+		gridPts[2] = _gridPts[2];
+		NPS01 = gridPts[0] * gridPts[1];
+		numVoxels = NPS01 * gridPts[2];
+		isToroidal = _isToroidal;
+
+		int stride[3] = {1, gridPts[0], NPS01};
+		for (int d=0; d< 3; d++)
+		{
+			axisNeighbors[d] = (int *)malloc(gridPts[d] * 4 * sizeof(int));
+			for (int i=0; i< gridPts[d]; i++)
+			{
+				int *nbr = axisNeighbors[d] + i * 4;
+				nbr[3] = neighbor_axis(i, gridPts[d], nbr);
+				for (int k=0; k< nbr[3]; k++)
+				{
+					nbr[k] *= stride[d];
+				}
+			}
+		}
+
+		numCells = numSorted = cellCapacity = 0;
+		cells = NULL;
+		sortedCells = NULL;
+		sortedVoxel = NULL;
+		cellVoxel = NULL;
+		pairStart = NULL;
+		voxelStart = (int *)malloc((numVoxels + 1) * sizeof(int));
+		memset(voxelStart, 0, (numVoxels + 1) * sizeof(int));
+	}
+
+	NtCellList::~NtCellList()
+	{
+		free(cells);
+		free(sortedCells);
+		free(sortedVoxel);
+		free(cellVoxel);
+		free(pairStart);
+		free(voxelStart);
+		for (int d=0; d< 3; d++)
+		{
+			free(axisNeighbors[d]);
+		}
+	}
+
+	NtCell **NtCellList::reserve(int n)
+	{
+		if (n > cellCapacity || cells == NULL)
+		{
+			cellCapacity = NtUtility::GetAllocSize(n, cellCapacity);
+			cells = (NtCell **)realloc(cells, cellCapacity * sizeof(NtCell *));
+			sortedCells = (NtCell *)realloc(sortedCells, cellCapacity * sizeof(NtCell));
+			sortedVoxel = (int *)realloc(sortedVoxel, cellCapacity * sizeof(int));
+			cellVoxel = (int *)realloc(cellVoxel, cellCapacity * sizeof(int));
+			pairStart = (int *)realloc(pairStart, (cellCapacity + 1) * sizeof(int));
+			if (cells == NULL || sortedCells == NULL || sortedVoxel == NULL || cellVoxel == NULL || pairStart == NULL)
+			{
+				throw new std::exception("Error: cell list allocation failed");
+			}
+		}
+		numCells = n;
+		return cells;
+	}
+
+	void NtCellList::sort()
+	{
+		memset(voxelStart, 0, (numVoxels + 1) * sizeof(int));
+		for (int i=0; i< numCells; i++)
+		{
+			int *g = cells[i]->gridIndex;
+			g[3] = 0; //index change consumed here
+			if (g[0] < 0)
+			{
+				cellVoxel[i] = -1;
+				continue;
+			}
+			int v = g[0] + g[1] * gridPts[0] + g[2] * NPS01;
+			cellVoxel[i] = v;
+			voxelStart[v]++;
+		}
+		//inclusive prefix sum, voxelStart[v] is the end of voxel v
+		for (int v=1; v< numVoxels; v++)
+		{
+			voxelStart[v] += voxelStart[v-1];
+		}
+		numSorted = voxelStart[numVoxels-1];
+		voxelStart[numVoxels] = numSorted;
+
+		//filling back to front moves voxelStart[v] down to the start of voxel v
+		//and keeps the cells of a voxel in their original order
+		for (int i= numCells-1; i >= 0; i--)
+		{
+			int v = cellVoxel[i];
+			if (v < 0)continue;
+			int pos = --voxelStart[v];
+			sortedCells[pos] = *cells[i];
+			sortedVoxel[pos] = v;
+		}
+	}
+
+	int NtCellList::count_pairs(int first, int last)
+	{
+		int nbr[27];
+		int nn = 0, current = -1;
+		int count = 0;
+		for (int p = first; p < last; p++)
+		{
+			if (sortedVoxel[p] != current)
+			{
+				current = sortedVoxel[p];
+				nn = neighbor_voxels(current, nbr);
+			}
+			//a pair is owned by the cell that comes first in sorted order
+			for (int k=0; k< nn; k++)
+			{
+				int start = voxelStart[nbr[k]];
+				int end = voxelStart[nbr[k]+1];
+				if (start <= p)start = p + 1;
+				if (end > start)count += end - start;
+			}
+		}
+		return count;
+	}
+
+	int NtCellList::fill_pairs(int first, int last, NtCellPair *pairs, int offset)
+	{
+		int nbr[27];
+		int nn = 0, current = -1;
+		NtCellPair *pair = pairs + offset;
+		for (int p = first; p < last; p++)
+		{
+			pairStart[p] = (int)(pair - pairs);
+			if (sortedVoxel[p] != current)
+			{
+				current = sortedVoxel[p];
+				nn = neighbor_voxels(current, nbr);
+			}
+			NtCell *a = sortedCells + p;
+			for (int k=0; k< nn; k++)
+			{
+				int start = voxelStart[nbr[k]];
+				int end = voxelStart[nbr[k]+1];
+				if (start <= p)start = p + 1;
+				for (int q = start; q < end; q++)
+				{
+					NtCell *b = sortedCells + q;
+					//distance is only needed by the burn in, which sets it itself
+					new (pair) NtCellPair(NtCellPair::make_key(a->cellId, b->cellId), a, b);
+					pair++;
+				}
+			}
+		}
+		return (int)(pair - pairs) - offset;
+	}
+
+	int NtCellList::neighbor_axis(int i, int n, int *out)
+	{
+		int m = 0;
+		for (int d = -1; d <= 1; d++)
+		{
+			int j = i + d;
+			if (j < 0 || j >= n)
+			{
+				if (!isToroidal)continue;
+				j = j < 0 ? j + n : j - n;
+			}
+			//small toroidal grids wrap onto the same voxel
+			bool found = false;
+			for (int k=0; k< m; k++)
+			{
+				if (out[k] == j)found = true;
+			}
+			if (!found)out[m++] = j;
+		}
+		return m;
+	}
+
+	int NtCellList::neighbor_voxels(int v, int *nbr)
+	{
+		int z = v / NPS01;
+		int y = (v - z * NPS01) / gridPts[0];
+		const int *xs = axisNeighbors[0] + (v - z * NPS01 - y * gridPts[0]) * 4;
+		const int *ys = axisNeighbors[1] + y * 4;
+		const int *zs = axisNeighbors[2] + z * 4;
+		int nn = 0;
+		for (int k=0; k< zs[3]; k++)
+		{
+			for (int j=0; j< ys[3]; j++)
+			{
+				int base = ys[j] + zs[k];
+				for (int i=0; i< xs[3]; i++)
+				{
+					nbr[nn++] = base + xs[i];
+				}
+			}
+		}
+		return nn;
+	}
+}
@@ -0,0 +1,90 @@
+/*
+Copyright (C) 2019 Kepler Laboratory of Quantitative Immunology
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY 
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH 
+THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+
+#ifdef COMPILE_FLAG
+#define DllExport __declspec(dllexport)
+#else 
+#define DllExport __declspec(dllimport)
+#endif
+
+#include <stdlib.h>
+#include "NtCellPair.h"
+
+namespace NativeDaphneLibrary
+{
+	//flat voxel cell list used by the collision manager.
+	//cells are counting sorted by voxel into sortedCells, sorted positions
+	//voxelStart[v] to voxelStart[v+1] hold the cells in voxel v.
+	//sortedCells holds copies so the pair fill reads them in order.
+	class DllExport NtCellList
+	{
+	public:
+		int numCells;
+		NtCell **cells;
+
+		//number of cells with a legal voxel, i.e. entries in sortedCells
+		int numSorted;
+		NtCell *sortedCells;
+		int *sortedVoxel;
+		int *voxelStart;
+
+		//pairs owned by sorted position p are pairStart[p] to pairStart[p+1]
+		int *pairStart;
+
+		NtCellList(int *_gridPts, bool _isToroidal);
+
+		~NtCellList();
+
+		//make room for n cells, the caller fills the returned array
+		NtCell **reserve(int n);
+
+		//counting sort of the cells by voxel
+		void sort();
+
+		//number of pairs owned by sorted positions [first, last)
+		int count_pairs(int first, int last);
+
+		//write the pairs owned by sorted positions [first, last) starting at pairs[offset]
+		int fill_pairs(int first, int last, NtCellPair *pairs, int offset);
+
+		//first sorted position of z plane k, k == gridPts[2] gives numSorted
+		int plane_start(int k)
+		{
+			return voxelStart[k * NPS01];
+		}
+
+	private:
+		int gridPts[3];
+		int NPS01;
+		int numVoxels;
+		bool isToroidal;
+		int cellCapacity;
+
+		//voxel of each cell in cells, -1 if outside the grid
+		int *cellVoxel;
+
+		//per axis, the distinct neighbour offsets (already multiplied by the
+		//axis stride) of each coordinate, 4 ints per coordinate, [3] is the count
+		int *axisNeighbors[3];
+
+		//distinct neighbour voxels of voxel v (including v), returns the count
+		int neighbor_voxels(int v, int *nbr);
+
+		//distinct neighbour coordinates along one axis
+		int neighbor_axis(int i, int n, int *out);
+	};
+}
@@ -28,7 +28,7 @@ THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 namespace NativeDaphneLibrary
 {
 
-	NtCellPair::NtCellPair(long key, NtCell* _a, NtCell* _b)
+	NtCellPair::NtCellPair(long long key, NtCell* _a, NtCell* _b)
 	{
 		X1 = _a->X;
 		F1 = _a->F;
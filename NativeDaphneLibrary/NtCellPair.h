@@ -35,12 +35,14 @@ namespace NativeDaphneLibrary
 	public:
 		double radius;
 		//bool isLegalIndex;
+		int cellId;
 		int *gridIndex;
 		double *X;
 		double *F;
 		NtCell(double _r, int *g)
 		{
 			radius = _r;
+			cellId = -1;
 			gridIndex = g;
 			//isLegalIndex = true;
 		}
@@ -60,10 +62,9 @@ namespace NativeDaphneLibrary
 		double sumRadius;	//8
 		double sumRadius2;  //8
 		double distance;	//8
-		long   pairKey;		//4 byte - the key of the pair
-		int	   padding;		//padding total to 64 bytes;
+		long long pairKey;	//8 byte - the key of the pair, total 64 bytes
 
-		NtCellPair(long key, NtCell* _a, NtCell* _b);
+		NtCellPair(long long key, NtCell* _a, NtCell* _b);
 
 		void copy(NtCellPair *src)
 		{
@@ -85,17 +86,25 @@ namespace NativeDaphneLibrary
 
 		void set_distance_toroidal();
 
+		//pair key from two cell ids, the larger id goes to the high 32 bits
+		static long long make_key(int id1, int id2)
+		{
+			unsigned long long max = (unsigned)(id1 > id2 ? id1 : id2);
+			unsigned long long min = (unsigned)(id1 > id2 ? id2 : id1);
+			return (long long)((max << 32) | min);
+		}
+
 		//get the cell id, index 0/1
 		//is is coupled with how the pair key is made
-		long get_cell_id(int index)
+		int get_cell_id(int index)
 		{
 			if (index == 0)
 			{
-				return (pairKey >>16);
+				return (int)(pairKey >> 32);
 			}
 			else 
 			{
-				return ((pairKey <<16)>>16);
+				return (int)(pairKey & 0xffffffff);
 			}
 		}
 	};
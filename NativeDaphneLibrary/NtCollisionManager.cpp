@@ -21,14 +21,12 @@ THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
-#include <unordered_map>
 #include <xmmintrin.h>
 #include <emmintrin.h>
+#include <immintrin.h>
 
 #include "NtCollisionManager.h"
 
-typedef std::list<int> LISTINT;
-
 namespace NativeDaphneLibrary
 {
 	double *NtCollisionManager::GridSize = NULL;
@@ -37,23 +35,26 @@ namespace NativeDaphneLibrary
 	double NtCollisionManager::Phi1 = 0;
 	int NtCollisionManager::max_pair_count = 0;
 
-	typedef std::unordered_map<int, NtCellPair *> PairMap;
-
 
 	NtCollisionManager::NtCollisionManager(double *gsize, double gstep, bool gtoroidal) : NtGrid(gsize, gstep, gtoroidal)
 	{
 			GridStep = gstep;
 			IsToroidal = gtoroidal;
 			GridSize = gridSize;
+			simdLevel = NtUtility::SimdLevel();
 
-			pairs = new std::unordered_map<long, NtCellPair *>();
+			cellList = new NtCellList(gridPts, gtoroidal);
+			numSlabs = gridPts[2];
+			slabPairStart = (int *)malloc((numSlabs + 1) * sizeof(int));
+			memset(slabPairStart, 0, (numSlabs + 1) * sizeof(int));
+			numPairs = 0;
 			max_pair_count = 0;
+			pairHighWaterMark = 0;
 
 
 			//handling storage
-			ReserveStorageSize = 1000000;
+			ReserveStorageSize = MIN_PAIR_CAPACITY;
 			PairArrayStorage = (NtCellPair *)_aligned_malloc(ReserveStorageSize * sizeof(NtCellPair), 64);
-			NextFreeIndex = 0;
 						
 			//thread stuff
 			MaxNumThreads = acmlgetnumthreads()-2; 
@@ -62,7 +63,11 @@ namespace NativeDaphneLibrary
 			jobHandles = (HANDLE *)malloc(MaxNumThreads * sizeof(HANDLE));
 			JobReadyEvents = (HANDLE *)malloc(MaxNumThreads * sizeof(HANDLE));
 
-			pairInteractArgs = (PairInteractArg **)malloc(MaxNumThreads * sizeof(PairInteractArg*));
+			//the last one is used by the main thread
+			pairInteractArgs = (PairInteractArg **)malloc((MaxNumThreads + 1) * sizeof(PairInteractArg*));
+			pairInteractArgs[MaxNumThreads] = new PairInteractArg();
+			pairInteractArgs[MaxNumThreads]->owner = this;
+			pairInteractArgs[MaxNumThreads]->threadId = MaxNumThreads;
 			for (int i=0; i< MaxNumThreads; i++)
 			{
 				unsigned int tid;
@@ -78,59 +83,44 @@ namespace NativeDaphneLibrary
 
 	void NtCollisionManager::pairInteract(double dt)
 	{
-
-		if (IsToroidal)
-		{
-			pairInteractToroidal(dt);
-			return;
-		}
 		pairInteractEx(0, numPairs, dt);
 	}
 
-	void NtCollisionManager::pairInteractToroidal(double dt)
+	void NtCollisionManager::pairInteractEx(int start_index, int n, double dt)
 	{
-		NtCellPair *pairArray = PairArrayStorage;
-		for (int i=0; i<numPairs; i++)
+		if (simdLevel != NtUtility::SIMD_NONE)
 		{
-			NtCellPair &pair = pairArray[i];
-			pair.set_distance_toroidal();
-			if (pair.distance == 0 || pair.distance >= pair.sumRadius)continue;
-
-			//divide by pair->distance is for normalize 
-			double force = Phi1 * (1.0/pair.distance - 1.0/pair.sumRadius)/pair.distance;
-
-			double *a_X = pair.X1;
-			double *b_X = pair.X2;
-			 
-			double dx = (b_X[0] - a_X[0]) * force;
-            double dy = (b_X[1] - a_X[1]) * force;
-            double dz = (b_X[2] - a_X[2]) * force;
-
-			double *a_F = pair.F1;
-			double *b_F = pair.F2;
-			a_F[0] -= dx;
-			a_F[1] -= dy;
-			a_F[2] -= dz;
-
-			b_F[0] += dx;
-			b_F[1] += dy;
-			b_F[2] += dz;
+			int done = IsToroidal ? pair_interact_avx2<true>(start_index, n) : pair_interact_avx2<false>(start_index, n);
+			start_index += done;
+			n -= done;
+		}
+		if (IsToroidal)
+		{
+			pair_interact<true>(start_index, n);
+		}
+		else 
+		{
+			pair_interact<false>(start_index, n);
 		}
 	}
 
-	//non-toroidal only
-	void NtCollisionManager::pairInteractEx(int start_index, int n, double dt)
+	//the minimum image is d - L * floor(d/L + 0.5), without branches so it vectorizes.
+	//the vector kernel does the same operations in the same order, the results are identical.
+	template <bool Toroidal>
+	void NtCollisionManager::pair_interact(int start_index, int n)
 	{
 		double sum_squares = 0;
 		double dx, dy, dz;
+		double L[3], invL[3];
+		for (int i=0; i< 3; i++)
+		{
+			L[i] = GridSize[i];
+			invL[i] = 1.0/GridSize[i];
+		}
 
 		NtCellPair *pairArray = PairArrayStorage;
 		for (int i=start_index, end=start_index+n; i < end; ++i)
 		{
-			//testing
-			//_mm_prefetch((char *)pairArray[i+1].X1, _MM_HINT_T0);
-			//_mm_prefetch((char *)pairArray[i+1].X2, _MM_HINT_T0);
-
 			NtCellPair &pair = pairArray[i];
 
 			double *a_X = pair.X1;
@@ -139,6 +129,12 @@ namespace NativeDaphneLibrary
 			dx = b_X[0] - a_X[0];
 			dy = b_X[1] - a_X[1];
 			dz = b_X[2] - a_X[2];
+			if (Toroidal)
+			{
+				dx -= L[0] * floor(dx * invL[0] + 0.5);
+				dy -= L[1] * floor(dy * invL[1] + 0.5);
+				dz -= L[2] * floor(dz * invL[2] + 0.5);
+			}
 			sum_squares = dx * dx + dy * dy + dz * dz;
 
 			if (sum_squares > pair.sumRadius2 || sum_squares == 0)continue;
@@ -162,6 +158,80 @@ namespace NativeDaphneLibrary
 		}
 	}
 
+	//the positions are loaded with a 3 element mask, detached cells only own 3 doubles.
+	//the forces are added lane by lane in pair order, like the scalar kernel.
+	template <bool Toroidal>
+	int NtCollisionManager::pair_interact_avx2(int start_index, int n)
+	{
+		const __m256i xyz = _mm256_set_epi64x(0, -1, -1, -1);
+		const __m256d half = _mm256_set1_pd(0.5);
+		const __m256d one = _mm256_set1_pd(1.0);
+		const __m256d zero = _mm256_setzero_pd();
+		const __m256d phi1 = _mm256_set1_pd(Phi1);
+		__m256d L[3], invL[3];
+		for (int i=0; i< 3; i++)
+		{
+			L[i] = _mm256_set1_pd(GridSize[i]);
+			invL[i] = _mm256_set1_pd(1.0/GridSize[i]);
+		}
+		double fx[4], fy[4], fz[4];
+
+		NtCellPair *pairArray = PairArrayStorage;
+		int count = n & ~3;
+		for (int i=start_index, end=start_index+count; i < end; i += 4)
+		{
+			NtCellPair *p = pairArray + i;
+			__m256d r0 = _mm256_sub_pd(_mm256_maskload_pd(p[0].X2, xyz), _mm256_maskload_pd(p[0].X1, xyz));
+			__m256d r1 = _mm256_sub_pd(_mm256_maskload_pd(p[1].X2, xyz), _mm256_maskload_pd(p[1].X1, xyz));
+			__m256d r2 = _mm256_sub_pd(_mm256_maskload_pd(p[2].X2, xyz), _mm256_maskload_pd(p[2].X1, xyz));
+			__m256d r3 = _mm256_sub_pd(_mm256_maskload_pd(p[3].X2, xyz), _mm256_maskload_pd(p[3].X1, xyz));
+
+			//transpose to x, y, z of the 4 pairs
+			__m256d t0 = _mm256_unpacklo_pd(r0, r1);
+			__m256d t1 = _mm256_unpackhi_pd(r0, r1);
+			__m256d t2 = _mm256_unpacklo_pd(r2, r3);
+			__m256d t3 = _mm256_unpackhi_pd(r2, r3);
+			__m256d dx = _mm256_permute2f128_pd(t0, t2, 0x20);
+			__m256d dy = _mm256_permute2f128_pd(t1, t3, 0x20);
+			__m256d dz = _mm256_permute2f128_pd(t0, t2, 0x31);
+			if (Toroidal)
+			{
+				dx = _mm256_sub_pd(dx, _mm256_mul_pd(L[0], _mm256_floor_pd(_mm256_add_pd(_mm256_mul_pd(dx, invL[0]), half))));
+				dy = _mm256_sub_pd(dy, _mm256_mul_pd(L[1], _mm256_floor_pd(_mm256_add_pd(_mm256_mul_pd(dy, invL[1]), half))));
+				dz = _mm256_sub_pd(dz, _mm256_mul_pd(L[2], _mm256_floor_pd(_mm256_add_pd(_mm256_mul_pd(dz, invL[2]), half))));
+			}
+			__m256d sum_squares = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+			__m256d sumRadius = _mm256_set_pd(p[3].sumRadius, p[2].sumRadius, p[1].sumRadius, p[0].sumRadius);
+			__m256d sumRadius2 = _mm256_set_pd(p[3].sumRadius2, p[2].sumRadius2, p[1].sumRadius2, p[0].sumRadius2);
+
+			int active = _mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(sum_squares, sumRadius2, _CMP_LE_OQ),
+				_mm256_cmp_pd(sum_squares, zero, _CMP_NEQ_OQ)));
+			if (active == 0)continue;
+
+			__m256d dist_inverse = _mm256_div_pd(one, _mm256_sqrt_pd(sum_squares));
+			__m256d force = _mm256_mul_pd(_mm256_mul_pd(phi1, _mm256_sub_pd(dist_inverse, _mm256_div_pd(one, sumRadius))), dist_inverse);
+			_mm256_storeu_pd(fx, _mm256_mul_pd(dx, force));
+			_mm256_storeu_pd(fy, _mm256_mul_pd(dy, force));
+			_mm256_storeu_pd(fz, _mm256_mul_pd(dz, force));
+
+			for (int k=0; k< 4; k++)
+			{
+				if ((active & (1 << k)) == 0)continue;
+				double *a_F = p[k].F1;
+				double *b_F = p[k].F2;
+				a_F[0] -= fx[k];
+				a_F[1] -= fy[k];
+				a_F[2] -= fz[k];
+
+				b_F[0] += fx[k];
+				b_F[1] += fy[k];
+				b_F[2] += fz[k];
+			}
+		}
+		_mm256_zeroupper();
+		return count;
+	}
+
 	//Compute mu for burn in step
 	//see Tom's burn in algorithm in Simulation.cs(line 1173) for detail
 	double NtCollisionManager::getBurnInMuValue(double integratorStep)
@@ -198,117 +268,203 @@ namespace NativeDaphneLibrary
 		return mu;
 	}
 
+	//a pair is owned by the cell that comes first in the z-major sorted order,
+	//so the pairs of z plane k only touch cells in planes k and k+1, and in the
+	//last plane for plane 0 of a toroidal grid. planes two apart never touch the
+	//same cell: the even planes are done in parallel, then the odd ones, then
+	//toroidal plane 0. every cell gets its pair forces in the same order
+	//whatever the number of threads.
 	int NtCollisionManager::MultiThreadPairInteract(double dt)
 	{
+		if (numPairs == 0)return 0;
+
+		if (!IsToroidal)
+		{
+			run_slab_jobs(0, dt);
+			run_slab_jobs(1, dt);
+		}
+		else 
+		{
+			run_slab_jobs(2, dt);
+			run_slab_jobs(1, dt);
+			pairInteractEx(slabPairStart[0], slabPairStart[1] - slabPairStart[0], dt);
+		}
+		return 0;
+	}
+
+	//the planes first, first+2, ... split into runs of about equal pair counts
+	void NtCollisionManager::run_slab_jobs(int first, double dt)
+	{
+		if (first >= numSlabs)return;
+		int numPhaseSlabs = (numSlabs - first + 1)/2;
+		int total = 0;
+		for (int k = first; k < numSlabs; k += 2)
+		{
+			total += slabPairStart[k+1] - slabPairStart[k];
+		}
+
+		int numJobs = MaxNumThreads + 1;
+		if (numJobs > numPhaseSlabs)numJobs = numPhaseSlabs;
+		if (numJobs > total/MIN_PAIRS_PER_JOB)numJobs = total/MIN_PAIRS_PER_JOB;
+		if (numJobs < 1)numJobs = 1;
+
+		//job 0 is run by the main thread
+		int k = first;
+		long long acc = 0;
+		for (int j=0; j< numJobs; j++)
+		{
+			PairInteractArg *arg = j == 0 ? pairInteractArgs[MaxNumThreads] : pairInteractArgs[j-1];
+			arg->start_index = k;
+			arg->n = 0;
+			arg->stride = 2;
+			arg->dt = dt;
+			arg->job = JOB_SLAB_INTERACT;
+			long long target = (long long)total * (j + 1) / numJobs;
+			int slabsLeft = (numSlabs - k + 1)/2;
+			while (k < numSlabs && (arg->n == 0 || (acc < target && slabsLeft > numJobs - 1 - j)))
+			{
+				acc += slabPairStart[k+1] - slabPairStart[k];
+				arg->n++;
+				k += 2;
+				slabsLeft--;
+			}
+		}
+
+		int numThreads = numJobs - 1;
+		::InterlockedExchange(&AcitveJobCount, numThreads);
+		for (int i=0; i< numThreads; i++)
+		{
+			::SetEvent(JobReadyEvents[i]);
+		}
+		run_job(pairInteractArgs[MaxNumThreads]);
+		if (numThreads > 0)
+		{
+			while (::InterlockedCompareExchange(&AcitveJobCount, 1, 0) != 0);
+		}
+	}
+
+	void NtCollisionManager::run_job(PairInteractArg *arg)
+	{
+		int first = arg->start_index;
+		switch (arg->job)
+		{
+		case JOB_COUNT_PAIRS:
+			arg->pair_count = cellList->count_pairs(first, first + arg->n);
+			break;
+		case JOB_FILL_PAIRS:
+			cellList->fill_pairs(first, first + arg->n, PairArrayStorage, arg->pair_offset);
+			break;
+		case JOB_SLAB_INTERACT:
+			for (int i=0, k=first; i< arg->n; i++, k += arg->stride)
+			{
+				pairInteractEx(slabPairStart[k], slabPairStart[k+1] - slabPairStart[k], arg->dt);
+			}
+			break;
+		}
+	}
 
-		int n = numPairs;
+	//split the sorted cells, the main thread takes the first range
+	void NtCollisionManager::partition_cells(int n)
+	{
 		int numThreads = MaxNumThreads;
-		int NumItemsPerThread = n /(numThreads + 2);
-		if (NumItemsPerThread < 100)
+		int NumItemsPerThread = n /(numThreads + 1);
+		if (NumItemsPerThread < MIN_CELLS_PER_JOB)
 		{
-			NumItemsPerThread = 100;
-			numThreads = n/100 - 2;
+			NumItemsPerThread = MIN_CELLS_PER_JOB;
+			numThreads = n/MIN_CELLS_PER_JOB - 1;
 			if (numThreads < 0)numThreads = 0;
 		}
+		cellJobThreads = numThreads;
 
-		//fprintf(stderr, "+++++ ready to run pair interact ++++ \n");
-		//temparily disable thread
-		//numThreads = 0;
-		//start job
-		::InterlockedExchange(&AcitveJobCount, numThreads);
-		int n0, nn;
-		n0 = nn = n - NumItemsPerThread * numThreads;
+		int nn = n - NumItemsPerThread * numThreads;
+		PairInteractArg *main_arg = pairInteractArgs[MaxNumThreads];
+		main_arg->start_index = 0;
+		main_arg->n = nn;
 		for (int i=0; i< numThreads; i++)
 		{
 			PairInteractArg *arg = pairInteractArgs[i];
 			arg->start_index = nn;
 			arg->n = NumItemsPerThread;
 			nn += NumItemsPerThread;
-			::SetEvent(JobReadyEvents[i]);
 		}
+	}
 
-		pairInteractEx(0, n0, dt);
-		//wait for job finish
+	void NtCollisionManager::run_cell_jobs(int job_type)
+	{
+		int numThreads = cellJobThreads;
+		::InterlockedExchange(&AcitveJobCount, numThreads);
+		for (int i=0; i< numThreads; i++)
+		{
+			pairInteractArgs[i]->job = job_type;
+			::SetEvent(JobReadyEvents[i]);
+		}
+		PairInteractArg *main_arg = pairInteractArgs[MaxNumThreads];
+		main_arg->job = job_type;
+		run_job(main_arg);
 		if (numThreads > 0)
 		{
 			while (::InterlockedCompareExchange(&AcitveJobCount, 1, 0) != 0);
 		}
-		return 0;
 	}
 
-	NtCellPair* NtCollisionManager::NewCellPair(long key, NtCell* _a, NtCell* _b)
+	//pairs are all cells in neighbouring voxels, each owned by the cell
+	//that comes first in the sorted order. count, prefix sum and fill keep
+	//the pair order independent of the number of threads.
+	int NtCollisionManager::UpdatePairs()
 	{
-		NtCellPair* cellpair = NULL;
-		unsigned count = (unsigned)FreePairList.size();
-		if (count > 0)
+		cellList->sort();
+		partition_cells(cellList->numSorted);
+		run_cell_jobs(JOB_COUNT_PAIRS);
+
+		int total = pairInteractArgs[MaxNumThreads]->pair_count;
+		pairInteractArgs[MaxNumThreads]->pair_offset = 0;
+		for (int i=0; i< cellJobThreads; i++)
 		{
-			cellpair = FreePairList[count-1];
-			FreePairList.pop_back();
+			pairInteractArgs[i]->pair_offset = total;
+			total += pairInteractArgs[i]->pair_count;
 		}
-		else 
+		reserve_pairs(total);
+		run_cell_jobs(JOB_FILL_PAIRS);
+		cellList->pairStart[cellList->numSorted] = total;
+		for (int k=0; k<= numSlabs; k++)
 		{
-			if (NextFreeIndex >= ReserveStorageSize)
-			{
-				return NULL; //or allocate more?
-			}
-
-			cellpair = &PairArrayStorage[NextFreeIndex];
-			NextFreeIndex++;
+			slabPairStart[k] = cellList->pairStart[cellList->plane_start(k)];
 		}
-		return new (cellpair) NtCellPair(key, _a, _b);
-	}
 
-	void NtCollisionManager::balance()
-	{
-		
-		unsigned count = (unsigned)FreePairList.size();
-		if (count == 0)
+		numPairs = total;
+		if (numPairs > pairHighWaterMark)
 		{
-			numPairs = NextFreeIndex;
-			return;
+			pairHighWaterMark = numPairs;
 		}
-
-		NtCellPair *pairArray = PairArrayStorage;
-		for (int i=0; i< (int)count; i++)
+		if (numPairs > max_pair_count)
 		{
-			NtCellPair* cellpair = FreePairList[i];
-			int index = (int)(cellpair - pairArray);
-			int last_used_index = NextFreeIndex-1;
-			//make sure the last slot is not free one.
-			while (last_used_index >= 0 && pairArray[last_used_index].pairKey == -1)
-			{
-				last_used_index--;
-				NextFreeIndex--;
-			}
-			//now index cannpt be equal to (NextFreeIndex-1) because that would have been 
-			//shinked in the above step, so we only need to deal with the ones that
-			//is less than NextFreeIndex-1, anyting beger would have been handled also!
-			if (index < NextFreeIndex-1)
-			{
-				cellpair->copy(&pairArray[NextFreeIndex-1]);
-				if (pairs->count(cellpair->pairKey) > 0)
-				{
-					(*pairs)[cellpair->pairKey] = cellpair;
-				}
-				NextFreeIndex--;
-			}
+			max_pair_count = numPairs;
 		}
-		numPairs = NextFreeIndex;
-		FreePairList.clear();
+		return 0;
 	}
 
-	NtCellPair* NtCollisionManager::resetPair(long key, NtCell* _a, NtCell* _b)
+	//the old pairs are not kept, they are about to be rebuilt
+	void NtCollisionManager::reserve_pairs(int n)
 	{
-		if (pairs->count(key) == 0)
+		int capacity = ReserveStorageSize;
+		if (n > capacity)
 		{
-			throw new std::exception("Error: pair with key not found!");
+			capacity = NtUtility::GetAllocSize(n, capacity);
 		}
-		NtCellPair *pair = (*pairs)[key];
-		if (pair == NULL)
+		else if (n < capacity/4 && capacity > MIN_PAIR_CAPACITY)
 		{
-			throw new std::exception("Error: pair with key is NULL!");
+			capacity = NtUtility::GetAllocSize(n, MIN_PAIR_CAPACITY);
 		}
-		return new (pair) NtCellPair(key, _a, _b);
+		if (capacity == ReserveStorageSize)return;
+
+		numPairs = 0;
+		_aligned_free(PairArrayStorage);
+		PairArrayStorage = (NtCellPair *)_aligned_malloc((size_t)capacity * sizeof(NtCellPair), 64);
+		if (PairArrayStorage == NULL)
+		{
+			ReserveStorageSize = 0;
+			throw new std::exception("Error: cell pair storage allocation failed");
+		}
+		ReserveStorageSize = capacity;
 	}
 }
-
@@ -22,17 +22,15 @@ THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #endif
 
 #include <stdlib.h>
-#include <unordered_map>
 #include <xmmintrin.h>
 #include <process.h>
 #include "NtGrid.h"
 #include "NtCellPair.h"
+#include "NtCellList.h"
 
 namespace NativeDaphneLibrary
 {
 
-	typedef std::unordered_map<int, NtCellPair *> PairMap;
-
 	class NtCollisionManager;
 	class DllExport PairInteractArg
 	{
@@ -42,6 +40,12 @@ namespace NativeDaphneLibrary
 		int n; //number of items
 		double dt; 
 		int threadId;
+		int job;
+		//slab jobs do every stride-th z plane
+		int stride;
+		//pair candidates of the cell range and where they go in the pair array
+		int pair_count;
+		int pair_offset;
 	};
 
 	#pragma warning (disable : 4251)
@@ -50,11 +54,52 @@ namespace NativeDaphneLibrary
 	{
 	private:
 
-		//note: using vector template here causing a compiler warning C4251
-		//but does not affect the running.
-		//to remove the warning, use another container
-		//or other tricks. we are disabling it for now
-		std::vector<NtCellPair *> FreePairList;
+		static const int JOB_SLAB_INTERACT = 0;
+		static const int JOB_COUNT_PAIRS = 1;
+		static const int JOB_FILL_PAIRS = 2;
+
+		//pairs handled by one slab job
+		static const int MIN_PAIRS_PER_JOB = 2000;
+
+		//sorted cells handled by one pair building job
+		static const int MIN_CELLS_PER_JOB = 1000;
+
+		//voxel cell list the pairs are built from
+		NtCellList *cellList;
+
+		//number of worker threads used by the current cell jobs
+		int cellJobThreads;
+
+		//the pair array is rebuilt every update and pairs are only referred to
+		//by index, so it is reallocated to grow on demand and to shrink when
+		//it is mostly unused.
+		static const int MIN_PAIR_CAPACITY = 4096;
+
+		//largest number of pairs seen
+		int pairHighWaterMark;
+
+		void reserve_pairs(int n);
+
+		//the pairs owned by the cells of z plane k are slabPairStart[k] to slabPairStart[k+1]
+		int *slabPairStart;
+		int numSlabs;
+
+		void run_slab_jobs(int first, double dt);
+
+		//NtUtility::SimdLevel(), picks the vector pair kernel
+		int simdLevel;
+
+		//scalar pair kernel, the toroidal one uses the minimum image
+		template <bool Toroidal>
+		void pair_interact(int start_index, int n);
+
+		//4 pairs per step, returns the number of pairs done
+		template <bool Toroidal>
+		int pair_interact_avx2(int start_index, int n);
+
+		void partition_cells(int n);
+
+		void run_cell_jobs(int job_type);
 
 	public:
 		static double *GridSize;
@@ -64,20 +109,14 @@ namespace NativeDaphneLibrary
 
 		static int max_pair_count;
 
-		std::unordered_map<long, NtCellPair *> *pairs;
-
 		int ReserveStorageSize;
 		NtCellPair *PairArrayStorage;
-		int NextFreeIndex;
-		//vector<NtCellPair *> FreePairList;
-
 
 		//thread stuff
 		int numPairs;
 		int MaxNumThreads;
 		HANDLE* jobHandles;
 		HANDLE* JobReadyEvents;
-		HANDLE* JobFinishedEvents;
 
 		PairInteractArg** pairInteractArgs;
 
@@ -87,17 +126,31 @@ namespace NativeDaphneLibrary
 		
 		~NtCollisionManager()
 		{
-			delete pairs;
-
-			_aligned_free(PairArrayStorage);
-
-			//stop threads
+			//stop threads, the workers read the cell list and pairs until they exit
 			for (int i=0; i<MaxNumThreads; i++)
 			{
 				PairInteractArg *arg = pairInteractArgs[i];
 				arg->n = -1;
 				::SetEvent(JobReadyEvents[i]);
 			}
+			WaitForMultipleObjects(MaxNumThreads, jobHandles, TRUE, INFINITE);
+			for (int i=0; i<MaxNumThreads; i++)
+			{
+				CloseHandle(jobHandles[i]);
+				CloseHandle(JobReadyEvents[i]);
+			}
+			for (int i=0; i<=MaxNumThreads; i++)
+			{
+				delete pairInteractArgs[i];
+			}
+			free(jobHandles);
+			free(JobReadyEvents);
+			free(pairInteractArgs);
+
+			delete cellList;
+
+			_aligned_free(PairArrayStorage);
+			free(slabPairStart);
 		}
 
 		static unsigned __stdcall PairInteractThreadEntry(void* pUserData) 
@@ -111,22 +164,28 @@ namespace NativeDaphneLibrary
 				WaitForSingleObject(owner->JobReadyEvents[tid], INFINITE); 
 				if (arg->n == -1) //signal to end thread
 				{
-					_endthread();
+					return 0;
 				}
-				arg->owner->pairInteractEx(arg->start_index, arg->n, arg->dt);
-				//fprintf(stderr, "pari_interact thread %d run once\n", arg->threadId);
+				owner->run_job(arg);
 				::InterlockedDecrement(&owner->AcitveJobCount);
 			}
 		}
 
 
-		//void updateExistingPairs();
+		void run_job(PairInteractArg *arg);
 
-		void pairInteract(double dt);
+		//array of the cells to be filled by the caller before UpdatePairs()
+		NtCell **ReserveCells(int n)
+		{
+			return cellList->reserve(n);
+		}
+
+		//rebuild the pair array from the cells in neighbouring voxels
+		int UpdatePairs();
 
-		void pairInteractToroidal(double dt);
+		void pairInteract(double dt);
 
-		//this is implemented for non-toroidal for testing...
+		//force of the pairs [start_index, start_index + num_items) added to the cells
 		void pairInteractEx(int start_index, int num_items, double dt);
 
 		double NtCollisionManager::getBurnInMuValue(double dt);
@@ -135,73 +194,19 @@ namespace NativeDaphneLibrary
 
 		int getPairCount()
 		{
-			return (int)pairs->size();
+			return numPairs;
 		}
 
-		bool itemExists(long key)
+		int getPairCapacity()
 		{
-			return (pairs->count(key) > 0);
+			return ReserveStorageSize;
 		}
 
-		//do we really have to add, there is nothing to do to add
-		//except setting its pairkey? if key = -1, then it is a free one.
-		bool addCellPair(long key, NtCellPair *p)
+		int getPairHighWaterMark()
 		{
-			//if we already have it
-			if (pairs->count(key) > 0)return false;
-			pairs->insert(std::make_pair(key, p));
-			
-			//debug - checking maximum pairs
-			int nPairs = NextFreeIndex - (int)FreePairList.size();
-			if (nPairs > max_pair_count)
-			{
-				max_pair_count = nPairs;
-				//if (max_pair_count%100 == 0)
-				/*{
-					fprintf(stdout, "Maximum pair count = %d\n", max_pair_count);
-				}*/
-			}
-			return true;
+			return pairHighWaterMark;
 		}
 
-		NtCellPair *getPair(long key)
-		{
-			return (*pairs)[key];
-		}
-
-		NtCellPair *NewCellPair(long key, NtCell* _a, NtCell* _b);
-
-		bool removePair(long key)
-		{
-			if (pairs->count(key) == 0)return false;
-			NtCellPair *p = (*pairs)[key];
-			p->pairKey = -1; //free slot now
-			FreePairList.push_back(p);
-			pairs->erase(key);
-			return true;
-		}
-
-		////return if removed.
-		//bool removePairOnClearSeparation(long key)
-		//{
-		//	if (pairs->count(key) == 0)return false;
-		//	NtCellPair *pair = getPair(key);
-		//	if (!IsToroidal)
-		//	{
-		//		if (ClearSeperation(pair) == true)
-		//		{
-		//			removePair(key);
-		//			return true;
-		//		}
-		//	}
-		//	else if (ClearSeperationToroidal(pair) == true)
-		//	{
-		//		removePair(key);
-		//		return true;
-		//	}
-		//	return false;
-		//}
-
 		bool isEmpty()
 		{
 			return getPairCount() == 0;
@@ -209,16 +214,8 @@ namespace NativeDaphneLibrary
 
 		void ClearPairs()
 		{
-			pairs->clear();
+			numPairs = 0;
 		}
-
-		//fill holes in cell pair array
-		void balance();
-
-		//reset pair pointers
-		NtCellPair* resetPair(long key, NtCell* _a, NtCell* _b);
-
-
 	};
 }
 
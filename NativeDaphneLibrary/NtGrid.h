@@ -74,6 +74,7 @@ namespace NativeDaphneLibrary
 		~NtGrid()
 		{
 			if (gridSize != NULL)_aligned_free(gridSize);
+			if (gridPts != NULL)free(gridPts);
 		}
 
 		//void linearIndexToIndexArray(int lin, int* idx)
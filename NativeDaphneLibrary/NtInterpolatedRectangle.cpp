@@ -0,0 +1,261 @@
+/*
+Copyright (C) 2019 Kepler Laboratory of Quantitative Immunology
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY 
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH 
+THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "stdafx.h"
+#include <acml.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xmmintrin.h>
+#include "NtUtility.h"
+#include "NtInterpolatedRectangle.h"
+
+namespace NativeDaphneLibrary
+{
+	NtInterpolatedRectangle::NtInterpolatedRectangle(int* extents, double step_size, bool toroidal)
+	{
+		NodesPerSide0 = extents[0];
+		NodesPerSide1 = extents[1];
+		StepSize = step_size;
+		isToroidal = toroidal;
+		coef2 = 1.0 / (StepSize * StepSize);
+		coef1 = -4.0 * coef2;
+
+		//thread related setup, see start_threads()
+		MaxNumThreads = acmlgetnumthreads()-4; 
+		if (MaxNumThreads <= 0)MaxNumThreads = 1;
+		jobHandles = NULL;
+		JobReadyEvents = NULL;
+		JobArgs = NULL;
+		NumStartedThreads = 0;
+	}
+
+	NtInterpolatedRectangle::~NtInterpolatedRectangle()
+	{
+		//terminate thread
+		for (int i=0; i<NumStartedThreads; i++)
+		{
+			JobArgs[i]->n = -1;
+			::SetEvent(JobReadyEvents[i]);
+		}
+		for (int i=0; i<NumStartedThreads; i++)
+		{
+			WaitForSingleObject(jobHandles[i], INFINITE);
+			CloseHandle(jobHandles[i]);
+			CloseHandle(JobReadyEvents[i]);
+			delete JobArgs[i];
+		}
+		free(jobHandles);
+		free(JobReadyEvents);
+		free(JobArgs);
+	}
+
+	void NtInterpolatedRectangle::start_threads(int n)
+	{
+		if (n <= NumStartedThreads)return;
+		if (jobHandles == NULL)
+		{
+			jobHandles = (HANDLE *)malloc(MaxNumThreads * sizeof(HANDLE));
+			JobReadyEvents = (HANDLE *)malloc(MaxNumThreads * sizeof(HANDLE));
+			JobArgs = (RectangleJobArg **)malloc(MaxNumThreads * sizeof(RectangleJobArg*));
+		}
+		for (int i = NumStartedThreads; i < n; i++)
+		{
+			unsigned int tid;
+			JobArgs[i] = new RectangleJobArg();
+			JobArgs[i]->owner = this;
+			JobArgs[i]->threadId = i;
+			JobArgs[i]->jobType = JOB_RESTRICT;
+			JobReadyEvents[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
+			jobHandles[i] = (HANDLE)_beginthreadex(0, 0, &RectangleThreadEntry, JobArgs[i], 0, &tid);
+		}
+		NumStartedThreads = n;
+	}
+
+	//the x edge nodes are peeled, the interior goes through the SSE loop
+	void NtInterpolatedRectangle::laplacian_rows(double *dst, const double *src, int j0, int j1)
+	{
+		int nx = NodesPerSide0 - 1;
+		for (int j = j0; j < j1; j++)
+		{
+			const double *c = src + j * NodesPerSide0;
+			const double *ym = src + row_minus(j) * NodesPerSide0;
+			const double *yp = src + row_plus(j) * NodesPerSide0;
+			double *d = dst + j * NodesPerSide0;
+
+			double xm = isToroidal ? c[nx - 1] : c[1];
+			d[0] = coef1 * c[0] + coef2 * (c[1] + xm + yp[0] + ym[0]);
+
+			int i = 1;
+#if defined(USE_SSE)
+			__m128d vc1 = _mm_set1_pd(coef1);
+			__m128d vc2 = _mm_set1_pd(coef2);
+			for (; i + 1 < nx; i += 2)
+			{
+				__m128d sum = _mm_add_pd(_mm_loadu_pd(c + i + 1), _mm_loadu_pd(c + i - 1));
+				sum = _mm_add_pd(sum, _mm_add_pd(_mm_loadu_pd(yp + i), _mm_loadu_pd(ym + i)));
+				__m128d v = _mm_add_pd(_mm_mul_pd(vc1, _mm_loadu_pd(c + i)), _mm_mul_pd(vc2, sum));
+				_mm_storeu_pd(d + i, v);
+			}
+#endif
+			for (; i < nx; i++)
+			{
+				d[i] = coef1 * c[i] + coef2 * (c[i + 1] + c[i - 1] + yp[i] + ym[i]);
+			}
+
+			double xp = isToroidal ? c[1] : c[nx - 1];
+			d[nx] = coef1 * c[nx] + coef2 * (xp + c[nx - 1] + yp[nx] + ym[nx]);
+		}
+	}
+
+	int NtInterpolatedRectangle::Laplacian(double *sfarray, double *retval, int n)
+	{
+		laplacian_rows(retval, sfarray, 0, NodesPerSide1);
+		return 0;
+	}
+
+	int NtInterpolatedRectangle::MultithreadLaplacian(double *sfarray, double *retval, int n)
+	{
+		int njobs = NodesPerSide1 / MIN_JOB_ROWS;
+		if (njobs > MaxNumThreads + 1)njobs = MaxNumThreads + 1;
+		if (njobs < 1)njobs = 1;
+		int numThreads = njobs - 1;
+
+		start_threads(numThreads);
+		::InterlockedExchange(&AcitveJobCount, numThreads);
+		for (int i = 0; i < numThreads; i++)
+		{
+			RectangleJobArg *arg = JobArgs[i];
+			arg->jobType = JOB_LAPLACIAN;
+			arg->sfarray = sfarray;
+			arg->dst = retval;
+			arg->j0 = i * NodesPerSide1 / njobs;
+			arg->j1 = (i + 1) * NodesPerSide1 / njobs;
+			arg->n = arg->j1 - arg->j0;
+			::SetEvent(JobReadyEvents[i]);
+		}
+
+		laplacian_rows(retval, sfarray, numThreads * NodesPerSide1 / njobs, NodesPerSide1);
+		//wait for job finish
+		if (numThreads > 0)
+		{
+			while (::InterlockedCompareExchange(&AcitveJobCount, 1, 0) != 0);
+		}
+		return 0;
+	}
+
+	double NtInterpolatedRectangle::node_gradient(const double *sfarray, int i, int j, int d)
+	{
+		int n = d == 0 ? NodesPerSide0 : NodesPerSide1;
+		int stride = d == 0 ? 1 : NodesPerSide0;
+		int k = d == 0 ? i : j;
+		const double *c = sfarray + i + j * NodesPerSide0;
+		if (k == n - 1)
+		{
+			if (isToroidal)return c[(1 - k) * stride] - c[-stride];
+			return 3 * c[0] - 4 * c[-stride] + c[-2 * stride];
+		}
+		if (k == 0)
+		{
+			if (isToroidal)return c[stride] - c[(n - 2) * stride];
+			return -3 * c[0] + 4 * c[stride] - c[2 * stride];
+		}
+		return c[stride] - c[-stride];
+	}
+
+	int NtInterpolatedRectangle::NativeRestrict(double *sfarray, double** position, int n, double **output)
+	{
+		double StepSizeInverse = 1.0 / StepSize;
+		double gradientFactor = 0.5 * StepSizeInverse;
+		for (int p = 0; p < n; p++)
+		{
+			double *pos = position[p];
+			double *out = output[p];
+			double tmpval = pos[0] * StepSizeInverse;
+			int idx0 = (int)tmpval;
+			if (idx0 == NodesPerSide0 - 1)idx0--;
+			double dx = tmpval - idx0;
+			tmpval = pos[1] * StepSizeInverse;
+			int idx1 = (int)tmpval;
+			if (idx1 == NodesPerSide1 - 1)idx1--;
+			double dy = tmpval - idx1;
+
+			double value = 0, gx = 0, gy = 0;
+			for (int di = 0; di < 2; di++)
+			{
+				for (int dj = 0; dj < 2; dj++)
+				{
+					double w = (di == 0 ? 1 - dx : dx) * (dj == 0 ? 1 - dy : dy);
+					int i = idx0 + di;
+					int j = idx1 + dj;
+					value += w * sfarray[i + j * NodesPerSide0];
+					gx += w * node_gradient(sfarray, i, j, 0);
+					gy += w * node_gradient(sfarray, i, j, 1);
+				}
+			}
+			out[0] = value;
+			out[1] = gx * gradientFactor;
+			out[2] = gy * gradientFactor;
+		}
+		return 0;
+	}
+
+	int NtInterpolatedRectangle::MultithreadNativeRestrict(double *sfarray, double** position, int n, double **output)
+	{
+		int numThreads = MaxNumThreads;
+		int NumItemsPerThread = n /(numThreads + 1);
+		if (NumItemsPerThread < MIN_JOB_POSITIONS)
+		{
+			NumItemsPerThread = MIN_JOB_POSITIONS;
+			numThreads = n / MIN_JOB_POSITIONS - 1;
+			if (numThreads < 0)numThreads = 0;
+		}
+
+		start_threads(numThreads);
+		::InterlockedExchange(&AcitveJobCount, numThreads);
+		int n0, nn;
+		n0 = nn = n - NumItemsPerThread * numThreads;
+		for (int i=0; i< numThreads; i++)
+		{
+			RectangleJobArg *arg = JobArgs[i];
+			arg->jobType = JOB_RESTRICT;
+			arg->sfarray = sfarray;
+			arg->position = position + nn;
+			arg->output = output + nn;
+			arg->n = NumItemsPerThread;
+			nn += NumItemsPerThread;
+			::SetEvent(JobReadyEvents[i]);
+		}
+
+		NativeRestrict(sfarray, position, n0, output);
+		//wait for job finish
+		if (numThreads > 0)
+		{
+			while (::InterlockedCompareExchange(&AcitveJobCount, 1, 0) != 0);
+		}
+		return 0;
+	}
+
+	void NtInterpolatedRectangle::run_job(RectangleJobArg *arg)
+	{
+		if (arg->jobType == JOB_LAPLACIAN)
+		{
+			laplacian_rows(arg->dst, arg->sfarray, arg->j0, arg->j1);
+		}
+		else
+		{
+			NativeRestrict(arg->sfarray, arg->position, arg->n, arg->output);
+		}
+	}
+}
@@ -0,0 +1,136 @@
+/*
+Copyright (C) 2019 Kepler Laboratory of Quantitative Immunology
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY 
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH 
+THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+
+#ifdef COMPILE_FLAG
+#define DllExport __declspec(dllexport)
+#else 
+#define DllExport __declspec(dllimport)
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <process.h>
+
+namespace NativeDaphneLibrary
+{
+	class NtInterpolatedRectangle;
+
+	class DllExport RectangleJobArg
+	{
+	public:
+		NtInterpolatedRectangle *owner;
+		int jobType;
+		double *sfarray;
+		//laplacian: rows [j0, j1) written to dst
+		double *dst;
+		int j0;
+		int j1;
+		//restrict: n positions, -1 to end the thread
+		double **position;
+		double **output;
+		int n;
+		int threadId;
+	};
+
+	//2d counterpart of NtInterpolatedRectangularPrism for the bilinear rectangle (Trilinear2D).
+	//node index is i + j * NodesPerSide0. zero flux boundaries mirror the inner neighbour,
+	//for toroidal grids node N-1 is the same point as node 0.
+	class DllExport NtInterpolatedRectangle
+	{
+	public:
+
+		NtInterpolatedRectangle(int* extents, double step_size, bool toroidal);
+
+		~NtInterpolatedRectangle();
+
+		//fused 5-point stencil
+		int Laplacian(double *sfarray, double *retval, int n);
+
+		//Laplacian() split into row bands over the worker threads
+		int MultithreadLaplacian(double *sfarray, double *retval, int n);
+
+		//value and gradient at n positions, output[p] holds value, d/dx, d/dy.
+		//same operators as Trilinear2D interpolationMatrix() and gradientMatrix().
+		int NativeRestrict(double *sfarray, double** position, int n, double **output);
+
+		int MultithreadNativeRestrict(double *sfarray, double** position, int n, double **output);
+
+	private:
+
+		static const int JOB_RESTRICT = 0;
+		static const int JOB_LAPLACIAN = 1;
+		//minimum number of rows per laplacian job
+		static const int MIN_JOB_ROWS = 16;
+		//minimum number of positions per restrict job
+		static const int MIN_JOB_POSITIONS = 20;
+
+		int NodesPerSide0;
+		int NodesPerSide1;
+		double StepSize;
+		bool isToroidal;
+		//laplacian coefficients, 1/h^2 and -4/h^2
+		double coef1;
+		double coef2;
+
+		//thread stuff
+		int MaxNumThreads;
+		HANDLE* jobHandles;
+		HANDLE* JobReadyEvents;
+		RectangleJobArg** JobArgs;
+		unsigned long AcitveJobCount;
+		//worker threads started so far, they are started by the first job that splits
+		int NumStartedThreads;
+
+		//start the worker threads 0..n-1 that are not running yet
+		void start_threads(int n);
+
+		void laplacian_rows(double *dst, const double *src, int j0, int j1);
+
+		//one sided difference at the zero flux boundary, centered otherwise
+		double node_gradient(const double *sfarray, int i, int j, int d);
+
+		void run_job(RectangleJobArg *arg);
+
+		int row_minus(int j)
+		{
+			return j > 0 ? j - 1 : (isToroidal ? NodesPerSide1 - 2 : 1);
+		}
+
+		int row_plus(int j)
+		{
+			return j < NodesPerSide1 - 1 ? j + 1 : (isToroidal ? 1 : NodesPerSide1 - 2);
+		}
+
+		static unsigned __stdcall RectangleThreadEntry(void* pUserData) 
+		{
+			RectangleJobArg *arg = (RectangleJobArg *)pUserData;
+			int tid = arg->threadId;
+			NtInterpolatedRectangle *owner = arg->owner;
+
+			while (true)
+			{
+				WaitForSingleObject(owner->JobReadyEvents[tid], INFINITE); 
+				if (arg->n == -1) //signal to end thread
+				{
+					return 0;
+				}
+				owner->run_job(arg);
+				::InterlockedDecrement(&owner->AcitveJobCount);
+			}
+		}
+	};
+}
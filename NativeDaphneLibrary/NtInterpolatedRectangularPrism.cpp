@@ -16,12 +16,17 @@ THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "stdafx.h"
 #include <acml.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include "NtInterpolatedRectangularPrism.h"
 #include <stdexcept>
 #include <xmmintrin.h>
+#include <immintrin.h>
 
 
-#include "NtInterpolation.h"
+#include "NtUtility.h"
+#include "NtSpectralDiffusion.h"
+#include "NtActiveRegion.h"
 
 //#define DO_PREFETCH
 
@@ -45,16 +50,49 @@ namespace NativeDaphneLibrary
 		StepSize = step_size;
 		gradientFactor = 1.0 /(2 * step_size);
 
-
-
-		//data for restrict - precompute local matrix
-		isToroidal = is_toroidal;
-		int n = NodesPerSide0 * NodesPerSide1 * NodesPerSide2;
-		localMatrixArray = (NtIndexMatrix *)malloc(n * sizeof(NtIndexMatrix));
-		for (int i= 0; i< n; i++)
+		//data for laplacian, the multipass tables are only built by initialize_laplacian()
+		coef2 = 1.0 / (step_size * step_size);
+		coef1 = -6.0 * coef2;
+		lpindex = sfindex = NULL;
+		_tmparr = NULL;
+		laplacianMethod = LAPLACIAN_FUSED;
+		//rows j-1..j+1 of plane k, rows j of planes k-1/k+1 and the output row
+		stencilRowBlock = STENCIL_CACHE_BYTES / (4 * NodesPerSide0 * (int)sizeof(double));
+		if (stencilRowBlock < 1)stencilRowBlock = 1;
+		planeBuffer = (double *)_aligned_malloc(4 * NPS01 * sizeof(double), 32);
+		slabBuffer = NULL;
+		speciesBuffer = NULL;
+		speciesBufferWidth = 0;
+		for (int e = 0; e < ADI_CACHE_SIZE; e++)
 		{
-			initialize_index_matrix(i);
+			adiCache[e].alpha = adiCache[e].theta = -1;
+			adiCache[e].factor[0].lower = NULL;
 		}
+		adiNext = 0;
+		spectral = NULL;
+		wavefrontBuffer = NULL;
+		wavefrontLevels = 0;
+		wavefrontPending = 0;
+		restrictStrategy = RESTRICT_AUTO;
+		restrictField = NULL;
+		depositOrder = NULL;
+		depositCapacity = 0;
+		exchangeStart = NULL;
+		exchangePosition = NULL;
+		exchangePointer = NULL;
+		exchangeFlux = NULL;
+		exchangeOutput = NULL;
+		exchangeIndex = NULL;
+		exchangeDelta = NULL;
+		exchangeCapacity = 0;
+		exchangeSlabs = 1;
+
+
+		//data for restrict - local matrix of the boundary cells, built on first use
+		isToroidal = is_toroidal;
+		restrictTable = NtOperatorCache::AcquireRestrictTable(extents, step_size, is_toroidal);
+		simdLevel = NtUtility::SimdLevel();
+		int n;
 
 		sf_prefetch_list[0] = -NPS01;
 		sf_prefetch_list[1] = NodesPerSide0 - NPS01;
@@ -113,6 +151,7 @@ namespace NativeDaphneLibrary
 			EcsArgs[i] = new EcsRestrictArg();
 			EcsArgs[i]->owner = this;
 			EcsArgs[i]->threadId = i;
+			EcsArgs[i]->jobType = JOB_RESTRICT;
 			JobReadyEvents[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
 			jobHandles[i] = (HANDLE)_beginthreadex(0, 0, &RestrictThreadEntry, EcsArgs[i], 0, &tid);
 		}
@@ -129,12 +168,84 @@ namespace NativeDaphneLibrary
 			arg->n = -1;
 			::SetEvent(JobReadyEvents[i]);
 		}
+		for (int i=0; i<MaxNumThreads; i++)
+		{
+			WaitForSingleObject(jobHandles[i], INFINITE);
+			CloseHandle(jobHandles[i]);
+			CloseHandle(JobReadyEvents[i]);
+			delete EcsArgs[i];
+		}
+		free(jobHandles);
+		free(JobReadyEvents);
+		free(EcsArgs);
+		CloseHandle(JobFinishedSignal);
 
-		if (localMatrixArray != NULL)
+		if (restrictTable != NULL)
 		{
-			free(localMatrixArray);
+			NtOperatorCache::ReleaseRestrictTable(restrictTable);
+			restrictTable = NULL;
 		}
 
+		if (lpindex != NULL)
+		{
+			free(lpindex);
+			free(sfindex);
+			lpindex = sfindex = NULL;
+		}
+		if (_tmparr != NULL)
+		{
+			free(_tmparr);
+			_tmparr = NULL;
+		}
+		if (planeBuffer != NULL)
+		{
+			_aligned_free(planeBuffer);
+			planeBuffer = NULL;
+		}
+		if (slabBuffer != NULL)
+		{
+			_aligned_free(slabBuffer);
+			slabBuffer = NULL;
+		}
+		if (speciesBuffer != NULL)
+		{
+			_aligned_free(speciesBuffer);
+			speciesBuffer = NULL;
+		}
+		for (int e = 0; e < ADI_CACHE_SIZE; e++)
+		{
+			free(adiCache[e].factor[0].lower);
+		}
+		if (spectral != NULL)
+		{
+			delete spectral;
+			spectral = NULL;
+		}
+		if (wavefrontBuffer != NULL)
+		{
+			_aligned_free(wavefrontBuffer);
+			wavefrontBuffer = NULL;
+		}
+		if (restrictField != NULL)
+		{
+			_aligned_free(restrictField);
+			restrictField = NULL;
+		}
+		if (depositOrder != NULL)
+		{
+			free(depositOrder);
+			depositOrder = NULL;
+		}
+		if (exchangePosition != NULL)
+		{
+			free(exchangePosition);
+			free(exchangePointer);
+			free(exchangeFlux);
+			free(exchangeOutput);
+			free(exchangeIndex);
+			free(exchangeDelta);
+			exchangePosition = NULL;
+		}
 	}
 
 	void NtInterpolatedRectangularPrism::initialize_laplacian(int* index_operator, 
@@ -158,298 +269,896 @@ namespace NativeDaphneLibrary
 	}
 	
 
-	//precompute localmatrixes
-	void NtInterpolatedRectangularPrism::initialize_index_matrix(int index)
+	int NtInterpolatedRectangularPrism::SetRestrictStrategy(int strategy)
+	{
+		int old_strategy = restrictStrategy;
+		restrictStrategy = strategy;
+		return old_strategy;
+	}
+
+	int NtInterpolatedRectangularPrism::SetLaplacianMethod(int method)
 	{
-		int idxarr[3];
-		int NPS01 = NodesPerSide0 * NodesPerSide1;
-		idxarr[2] = index/NPS01;
-		idxarr[1] = (index%NPS01)/NodesPerSide0;
-		idxarr[0] = (index%NPS01)%NodesPerSide0;
+		int old_method = laplacianMethod;
+		laplacianMethod = method;
+		return old_method;
+	}
 
-		if (idxarr[0] == NodesPerSide0 - 1)
+	/***************************************************************************************************
+	 * single pass 7-point stencil for one x row.
+	 * the row pointers for the y and z neighbours are resolved by the caller (see row_minus/plane_minus),
+	 * so the only boundary handling left here is the two peeled x edge nodes:
+	 *    zero flux - the missing neighbour mirrors the inner one, i.e. c[-1] = c[1], c[nx+1] = c[nx-1]
+	 *    toroidal  - node 0 and node nx are the same point, c[-1] = c[nx-1], c[nx+1] = c[1]
+	 * the interior nodes need no branching and go through the SSE loop.
+	 ***************************************************************************************************/
+	void NtInterpolatedRectangularPrism::stencil_row(double *dst, const double *c, const double *ym, const double *yp, 
+			const double *zm, const double *zp, double w0, double w1)
+	{
+		int nx = NodesPerSide0m1;
+		double xm = isToroidal ? c[nx - 1] : c[1];
+		double xp = c[1];
+		dst[0] = w0 * c[0] + w1 * (xp + xm + yp[0] + ym[0] + zp[0] + zm[0]);
+
+		int i = 1;
+#if defined(USE_SSE)
+		__m128d vw0 = _mm_set1_pd(w0);
+		__m128d vw1 = _mm_set1_pd(w1);
+		for (; i + 1 < nx; i += 2)
+		{
+			__m128d sum = _mm_add_pd(_mm_loadu_pd(c + i + 1), _mm_loadu_pd(c + i - 1));
+			sum = _mm_add_pd(sum, _mm_add_pd(_mm_loadu_pd(yp + i), _mm_loadu_pd(ym + i)));
+			sum = _mm_add_pd(sum, _mm_add_pd(_mm_loadu_pd(zp + i), _mm_loadu_pd(zm + i)));
+			__m128d v = _mm_add_pd(_mm_mul_pd(vw0, _mm_loadu_pd(c + i)), _mm_mul_pd(vw1, sum));
+			_mm_storeu_pd(dst + i, v);
+		}
+#endif
+		for (; i < nx; i++)
 		{
-			idxarr[0]--;
+			dst[i] = w0 * c[i] + w1 * (c[i + 1] + c[i - 1] + yp[i] + ym[i] + zp[i] + zm[i]);
 		}
-		if (idxarr[1] == NodesPerSide1 - 1)
+
+		xm = c[nx - 1];
+		xp = isToroidal ? c[1] : c[nx - 1];
+		dst[nx] = w0 * c[nx] + w1 * (xp + xm + yp[nx] + ym[nx] + zp[nx] + zm[nx]);
+	}
+
+	//the rows are processed in blocks of stencilRowBlock, sweeping z within a block,
+	//so that the planes k-1, k, k+1 of the block are still in cache when plane k+1 is reached.
+	//each node is loaded from memory once and each output value is written once.
+	void NtInterpolatedRectangularPrism::stencil_slab(double *dst, const double *src, int k0, int k1, double w0, double w1)
+	{
+		for (int jb = 0; jb < NodesPerSide1; jb += stencilRowBlock)
 		{
-			idxarr[1]--;
+			int je = jb + stencilRowBlock;
+			if (je > NodesPerSide1)je = NodesPerSide1;
+			for (int k = k0; k < k1; k++)
+			{
+				const double *plane = src + k * NPS01;
+				const double *zm = src + plane_minus(k) * NPS01;
+				const double *zp = src + plane_plus(k) * NPS01;
+				double *dplane = dst + k * NPS01;
+				for (int j = jb; j < je; j++)
+				{
+					int row = j * NodesPerSide0;
+					stencil_row(dplane + row, plane + row, 
+						plane + row_minus(j) * NodesPerSide0, plane + row_plus(j) * NodesPerSide0,
+						zm + row, zp + row, w0, w1);
+				}
+			}
 		}
-		if (idxarr[2] == NodesPerSide2 - 1)
+	}
+
+	/***************************************************************************************************
+	 * c += alpha * laplacian(c) in place, i.e. the stencil with w0 = 1 + alpha * coef1, w1 = alpha * coef2.
+	 * the new plane k is computed into the rolling buffer and only written back after plane k+1
+	 * is done, at which point the old plane k is no longer needed.
+	 * the neighbours outside [k0, k1) are read from the halo copies, they may already have been
+	 * overwritten (the other end for toroidal z, or another slab).
+	 ***************************************************************************************************/
+	void NtInterpolatedRectangularPrism::diffuse_slab(double *sfarray, int k0, int k1, double w0, double w1, 
+			const double *halo_lo, const double *halo_hi, double *buffer)
+	{
+		double *buf[2];
+		buf[0] = buffer;
+		buf[1] = buffer + NPS01;
+		for (int k = k0; k < k1; k++)
 		{
-			idxarr[2]--;
+			const double *plane = sfarray + k * NPS01;
+			const double *zm = k == k0 ? halo_lo : plane - NPS01;
+			const double *zp = k == k1 - 1 ? halo_hi : plane + NPS01;
+			double *dplane = buf[(k - k0) & 1];
+			for (int j = 0; j < NodesPerSide1; j++)
+			{
+				int row = j * NodesPerSide0;
+				stencil_row(dplane + row, plane + row, 
+					plane + row_minus(j) * NodesPerSide0, plane + row_plus(j) * NodesPerSide0,
+					zm + row, zp + row, w0, w1);
+			}
+			if (k > k0)
+			{
+				memcpy(sfarray + (k - 1) * NPS01, buf[(k - 1 - k0) & 1], NPS01 * sizeof(double));
+			}
 		}
+		memcpy(sfarray + (k1 - 1) * NPS01, buf[(k1 - 1 - k0) & 1], NPS01 * sizeof(double));
+	}
+
+	int NtInterpolatedRectangularPrism::Diffuse(double *sfarray, double alpha)
+	{
+		double *halo_lo = planeBuffer + 2 * NPS01;
+		double *halo_hi = planeBuffer + 3 * NPS01;
+		memcpy(halo_lo, sfarray + plane_minus(0) * NPS01, NPS01 * sizeof(double));
+		memcpy(halo_hi, sfarray + plane_plus(NodesPerSide2m1) * NPS01, NPS01 * sizeof(double));
+		diffuse_slab(sfarray, 0, NodesPerSide2, 1.0 + alpha * coef1, alpha * coef2, halo_lo, halo_hi, planeBuffer);
+		return 0;
+	}
 
-		int base_index = index;
+	int NtInterpolatedRectangularPrism::MultithreadDiffuse(double *sfarray, double alpha)
+	{
+		run_slab_jobs(JOB_DIFFUSE, sfarray, sfarray, 1.0 + alpha * coef1, alpha * coef2);
+		return 0;
+	}
 
-		int bound_flag = 0;
-		if (idxarr[0] == 0) bound_flag |= XLEFT;
-		else if (idxarr[0] + 1 == NodesPerSide0 - 1)bound_flag |= XRIGHT;
-		if (idxarr[1] == 0) bound_flag |= YLEFT;
-		else if (idxarr[1] + 1 == NodesPerSide1 - 1)bound_flag |= YRIGHT;
-		if (idxarr[2] == 0)bound_flag |= ZLEFT;
-		else if (idxarr[2] + 1 == NodesPerSide2 - 1)bound_flag |= ZRIGHT;
+	int NtInterpolatedRectangularPrism::MultithreadLaplacian(double *sfarray, double *retval, int n)
+	{
+		run_slab_jobs(JOB_LAPLACIAN, retval, sfarray, coef1, coef2);
+		return 0;
+	}
 
-		NtIndexMatrix *lm = &localMatrixArray[index];
-		lm->boundFlag = bound_flag;
-		
-		//if internal node, we don't compute neighbours
-		if (bound_flag == 0)return;
+	int NtInterpolatedRectangularPrism::FirstTouchCopy(double *dst, double *src)
+	{
+		run_slab_jobs(JOB_FIRST_TOUCH, dst, src, 0, 0);
+		return 0;
+	}
 
-		int *lm_index1 = lm->indexArray;
-		int *lm_index2 = lm->indexArray + 20;
-		int *lm_index3 = lm->indexArray + 40;
+	//the active tiles are computed into the tile buffer first and copied back in a second
+	//pass, the tiles read the old values of their neighbours.
+	int NtInterpolatedRectangularPrism::DiffuseActive(double *sfarray, double alpha, NtActiveRegion *region)
+	{
+		if (region->Update(sfarray) == 0)return 0;
+		double w0 = 1.0 + alpha * coef1;
+		double w1 = alpha * coef2;
+		run_tile_jobs(JOB_ACTIVE_DIFFUSE, region, sfarray, w0, w1);
+		run_tile_jobs(JOB_ACTIVE_WRITE, region, sfarray, w0, w1);
+		region->MarkChanged();
+		return 0;
+	}
 
-		////if its a internal node, then we make the memory contigougs for the index
-		//if (bound_flag == 0)
-		//{
-		//	lm_index2 = lm->indexArray + 16;
-		//	lm_index3 = lm->indexArray + 32;
-		//}
+	void NtInterpolatedRectangularPrism::run_tile_jobs(int job_type, NtActiveRegion *region, double *sfarray, double w0, double w1)
+	{
+		int count = region->ActiveCount;
+		int njobs = count / MIN_JOB_TILES;
+		if (njobs > MaxNumThreads + 1)njobs = MaxNumThreads + 1;
+		if (njobs < 1)njobs = 1;
+		int numThreads = njobs - 1;
+		double *buffer = region->TileBuffer();
+
+		EcsRestrictArg main_arg;
+		::InterlockedExchange(&AcitveJobCount, numThreads);
+		for (int i = njobs - 1; i >= 0; i--)
+		{
+			EcsRestrictArg *arg = i < numThreads ? EcsArgs[i] : &main_arg;
+			arg->jobType = job_type;
+			arg->region = region;
+			arg->sfarray = sfarray;
+			arg->dst = buffer;
+			arg->w0 = w0;
+			arg->w1 = w1;
+			arg->k0 = i * count / njobs;
+			arg->k1 = (i + 1) * count / njobs;
+			arg->n = arg->k1 - arg->k0;
+			if (i < numThreads)::SetEvent(JobReadyEvents[i]);
+		}
 
-		int n, n1, n2;
-		n = n1 = n2 = 0;
+		run_job(&main_arg);
+		//wait for job finish
+		if (numThreads > 0)
+		{
+			while (::InterlockedCompareExchange(&AcitveJobCount, 1, 0) != 0);
+		}
+	}
 
-		int node_index = 0;
-		for (int di = 0; di < 2; di++)
+	void NtInterpolatedRectangularPrism::run_job(EcsRestrictArg *arg)
+	{
+		switch (arg->jobType)
 		{
-			for (int dj = 0; dj < 2; dj++)
+		case JOB_LAPLACIAN:
+			stencil_slab(arg->dst, arg->sfarray, arg->k0, arg->k1, arg->w0, arg->w1);
+			break;
+		case JOB_DIFFUSE:
+			diffuse_slab(arg->sfarray, arg->k0, arg->k1, arg->w0, arg->w1, arg->haloLo, arg->haloHi, arg->buffer);
+			break;
+		case JOB_FIRST_TOUCH:
+			memcpy(arg->dst + arg->k0 * NPS01, arg->sfarray + arg->k0 * NPS01, (arg->k1 - arg->k0) * NPS01 * sizeof(double));
+			break;
+		case JOB_ACTIVE_DIFFUSE:
+			arg->region->DiffuseTiles(arg->sfarray, arg->k0, arg->k1, arg->w0, arg->w1, arg->dst);
+			break;
+		case JOB_ACTIVE_WRITE:
+			arg->region->WriteTiles(arg->sfarray, arg->k0, arg->k1, arg->dst);
+			break;
+		case JOB_NODE_GRADIENT:
+			node_gradient_slab(arg->dst, arg->sfarray, arg->k0, arg->k1);
+			break;
+		case JOB_FIELD_RESTRICT:
+			FieldRestrict(arg->sfarray, arg->position, arg->n, arg->_output);
+			break;
+		case JOB_DEPOSIT:
+			deposit_positions(arg->position, arg->flux, arg->order, arg->n, arg->dst, NULL, NULL);
+			break;
+		case JOB_REDUCE:
+			reduce_slab(arg->position, arg->n, arg->k0, arg->k1, arg->dst);
+			break;
+		case JOB_WAVEFRONT:
+			wavefront_slab(arg->sfarray, arg->k0, arg->k1, arg->levels, arg->w0, arg->w1, arg->buffer, arg->haloLo);
+			break;
+		case JOB_EXCHANGE:
+		case JOB_EXCHANGE_EDGE:
+			for (int s = arg->k0; s < arg->k1; s++)
 			{
-				for (int dk = 0; dk < 2; dk++)
+				int k0 = s * (NodesPerSide2 - 1) / exchangeSlabs;
+				int k1 = (s + 1) * (NodesPerSide2 - 1) / exchangeSlabs;
+				if (arg->jobType == JOB_EXCHANGE)
+				{
+					exchange_slab(arg->sfarray, k0, k1);
+				}
+				else
 				{
-					node_index = base_index + di  + dj * NodesPerSide0 + dk * NPS01;
+					exchange_edges(arg->sfarray, k0, k1);
+				}
+			}
+			break;
+		default:
+			NativeRestrictVector(arg->sfarray, arg->position, arg->n, arg->_output);
+			break;
+		}
+	}
 
-					// 0th element:
-					if (idxarr[0] + di == NodesPerSide0 - 1) //right side ==> di == 1, rightBound == true.
-					{
-						if (isToroidal)
-						{
-							lm_index1[n++] = (1) + (idxarr[1] + dj) * NodesPerSide0 + (idxarr[2] + dk) * NPS01;
-							lm_index1[n++] = node_index -1;
-						}
-						else
-						{
-							lm_index1[n++] = node_index;
-							lm_index1[n++] = node_index-1;
-							lm_index1[n++] = node_index-2;
-						}
-					}
-					else if (idxarr[0] + di == 0) //left bound di == 0 && LeftBound == true
-					{
-						if (isToroidal)
-						{
-							lm_index1[n++] = node_index + 1;
-							lm_index1[n++] =  (NodesPerSide0 - 2) + (idxarr[1] + dj) * NodesPerSide0 + (idxarr[2] + dk) * NPS01;
-							//lm_index1[n] = -1;
-						}
-						else
-						{
-							lm_index1[n++] = node_index;
-							lm_index1[n++] = node_index + 1;
-							lm_index1[n++] = node_index + 2;
-                        }
-					}
-					else
-					{
-						lm_index1[n++] = node_index + 1;
-						lm_index1[n++] = node_index - 1;
-						//lm_index1[n] = -1;
-					}  
+	/***************************************************************************************************
+	 * z slab decomposition, slab i is planes [i * N / nslabs, (i + 1) * N / nslabs).
+	 * the partition only depends on the grid, so a slab always goes to the same thread and
+	 * FirstTouchCopy() places its pages with the thread that updates it.
+	 * for the in place diffusion the halo planes of all slabs are copied before any slab starts,
+	 * this also covers the toroidal wrap (the halos of the end slabs are planes N-2 and 1).
+	 ***************************************************************************************************/
+	void NtInterpolatedRectangularPrism::run_slab_jobs(int job_type, double *dst, double *src, double w0, double w1)
+	{
+		int nslabs = slab_count();
+		int numThreads = nslabs - 1;
 
-					// 1st element:
-					if (idxarr[1] + dj == NodesPerSide1 - 1)
-					{
-						if (isToroidal)
-						{
-							lm_index2[n1++] = (idxarr[0] + di) + (1) * NodesPerSide0 + (idxarr[2] + dk) * NPS01;
-							lm_index2[n1++] = node_index - NodesPerSide0;
-						}
-						else
-                        {
-							lm_index2[n1++] = node_index;
-							lm_index2[n1++] = node_index - NodesPerSide0;
-							lm_index2[n1++] = node_index - NodesPerSide0 * 2;
-                        }
-					}
-                    else if (idxarr[1] + dj == 0)
-					{
-						if (isToroidal)
-						{
-							lm_index2[n1++] = node_index - NodesPerSide0 * 2;
-							lm_index2[n++] = (idxarr[0] + di) + (NodesPerSide1 - 2) * NodesPerSide0 + (idxarr[2] + dk) * NPS01;
-						}
-						else
-						{
-							lm_index2[n1++] = node_index;
-							lm_index2[n1++] = node_index + NodesPerSide0;
-							lm_index2[n1++] = node_index + NodesPerSide0 * 2;
-						}
-					}
-					else
-					{
-						lm_index2[n1++] = node_index + NodesPerSide0;
-						lm_index2[n1++] = node_index - NodesPerSide0;
-					}
+		if (job_type == JOB_DIFFUSE && slabBuffer == NULL)
+		{
+			slabBuffer = (double *)_aligned_malloc((MaxNumThreads + 1) * 4 * NPS01 * sizeof(double), 32);
+		}
 
-					//2nd element
-					if (idxarr[2] + dk == NodesPerSide2 - 1)
-                    {
-						if (isToroidal)
-                        {
-							lm_index3[n2++] = (idxarr[0] + di) + (idxarr[1] + dj) * NodesPerSide0 + (1) * NPS01;
-							lm_index3[n2++] = node_index - NPS01; 
-                        }
-                        else
-                        {
-							lm_index3[n2++] = node_index; // 3, -4, 1
-							lm_index3[n2++] = node_index - NPS01;
-							lm_index3[n2++] = node_index - NPS01 * 2;
-                        }
-					}
-                    else if (idxarr[2] + dk == 0)
-                    {
-						if (isToroidal)
-                        {
-							lm_index3[n2++] = node_index + NPS01;
-							lm_index3[n2++] = (idxarr[0] + di) + (idxarr[1] + dj) * NodesPerSide0 + (NodesPerSide2 - 2) * NPS01;
-                        }
-                        else
-                        {
-							lm_index3[n2++] = node_index; // -3, 4, -1
-							lm_index3[n2++] = node_index + NPS01;
-							lm_index3[n2++] = node_index + NPS01 * 2;
-						}
-					}
-                    else
-                    {
-						lm_index3[n2++] = node_index + NPS01;
-						lm_index3[n2++] = node_index - NPS01;
-					}        
-				}
+		EcsRestrictArg main_arg;
+		::InterlockedExchange(&AcitveJobCount, numThreads);
+		for (int i = nslabs - 1; i >= 0; i--)
+		{
+			EcsRestrictArg *arg = i < numThreads ? EcsArgs[i] : &main_arg;
+			arg->jobType = job_type;
+			arg->sfarray = src;
+			arg->dst = dst;
+			arg->w0 = w0;
+			arg->w1 = w1;
+			arg->k0 = i * NodesPerSide2 / nslabs;
+			arg->k1 = (i + 1) * NodesPerSide2 / nslabs;
+			arg->n = arg->k1 - arg->k0;
+			if (job_type == JOB_DIFFUSE)
+			{
+				arg->buffer = slabBuffer + i * 4 * NPS01;
+				arg->haloLo = arg->buffer + 2 * NPS01;
+				arg->haloHi = arg->buffer + 3 * NPS01;
+				memcpy(arg->haloLo, src + plane_minus(arg->k0) * NPS01, NPS01 * sizeof(double));
+				memcpy(arg->haloHi, src + plane_plus(arg->k1 - 1) * NPS01, NPS01 * sizeof(double));
 			}
 		}
-		
-		if (bound_flag == 0 && (n != 16 || n1 !=16 || n2 != 16))
+		//all halos are taken before the workers start writing
+		for (int i = 0; i < numThreads; i++)
 		{
-			fprintf(stderr, "Erroring initializing local matrix");
-			exit(1);
+			::SetEvent(JobReadyEvents[i]);
 		}
-		else if (n != 16 && n != 20 || n1 != 16 && n1 != 20 || n2 != 16 && n2 != 20)
+
+		run_job(&main_arg);
+		//wait for job finish
+		if (numThreads > 0)
 		{
-			fprintf(stderr, "Erroring initializing local matrix");
-			exit(1);
+			while (::InterlockedCompareExchange(&AcitveJobCount, 1, 0) != 0);
 		}
 	}
 
-	//not yet implemented
-	int NtInterpolatedRectangularPrism::Laplacian(double *sfarray, double *retval, int n)
-	{ 
+	void NtInterpolatedRectangularPrism::pack_plane(double *dst, double **sfarrays, int k, int nspecies, int width)
+	{
+		int offset = k * NPS01;
+		for (int s = 0; s < nspecies; s++)
+		{
+			const double *src = sfarrays[s] + offset;
+			double *p = dst + s;
+			for (int i = 0; i < NPS01; i++, p += width)
+			{
+				*p = src[i];
+			}
+		}
+		//padding lanes
+		for (int s = nspecies; s < width; s++)
+		{
+			double *p = dst + s;
+			for (int i = 0; i < NPS01; i++, p += width)
+			{
+				*p = 0;
+			}
+		}
+	}
 
-		dscal(n, 0.0, retval, 1);
-		dscal(n, 0.0, _tmparr, 1);
+	//the neighbour classification is done once per node for all species,
+	//each pair of species then goes through one SSE lane pair.
+	void NtInterpolatedRectangularPrism::stencil_row_multi(double **dst, int offset, const double *c, const double *ym, const double *yp, 
+			const double *zm, const double *zp, const double *w0, const double *w1, int nspecies, int width)
+	{
+		int nx = NodesPerSide0m1;
+		for (int i = 0; i <= nx; i++)
+		{
+			int im = i > 0 ? i - 1 : (isToroidal ? nx - 1 : 1);
+			int ip = i < nx ? i + 1 : (isToroidal ? 1 : nx - 1);
+			int n0 = i * width;
+			const double *xm = c + im * width;
+			const double *xp = c + ip * width;
+			int s = 0;
+#if defined(USE_SSE)
+			for (; s < nspecies; s += 2)
+			{
+				__m128d sum = _mm_add_pd(_mm_load_pd(xp + s), _mm_load_pd(xm + s));
+				sum = _mm_add_pd(sum, _mm_add_pd(_mm_load_pd(yp + n0 + s), _mm_load_pd(ym + n0 + s)));
+				sum = _mm_add_pd(sum, _mm_add_pd(_mm_load_pd(zp + n0 + s), _mm_load_pd(zm + n0 + s)));
+				__m128d v = _mm_add_pd(_mm_mul_pd(_mm_load_pd(w0 + s), _mm_load_pd(c + n0 + s)), 
+					_mm_mul_pd(_mm_load_pd(w1 + s), sum));
+				_mm_storel_pd(dst[s] + offset + i, v);
+				if (s + 1 < nspecies)_mm_storeh_pd(dst[s + 1] + offset + i, v);
+			}
+#endif
+			for (; s < nspecies; s++)
+			{
+				dst[s][offset + i] = w0[s] * c[n0 + s] + w1[s] * (xp[s] + xm[s] + yp[n0 + s] + ym[n0 + s] + zp[n0 + s] + zm[n0 + s]);
+			}
+		}
+	}
 
-		int step2 = NodesPerSide0 * NodesPerSide1;
-		int shifts[7] = {0, 1, -1, NodesPerSide0, -NodesPerSide0, step2, -step2};
-		for (int i= 1; i< 7; i++)
+	/***************************************************************************************************
+	 * batched Diffuse() for several species on this grid.
+	 * planes k-1, k, k+1 are kept packed species-interleaved in a ring of buffers, the
+	 * new values of plane k are written straight back to the species arrays since the old
+	 * values are only read from the packed copies. the last plane reads the packed copy of
+	 * plane N-2 (zero flux) or a saved copy of plane 1 (toroidal), both already overwritten.
+	 * the species arrays stay contiguous, restrict and reactions work on them unchanged.
+	 ***************************************************************************************************/
+	int NtInterpolatedRectangularPrism::DiffuseMulti(double **sfarrays, double *alphas, int nspecies)
+	{
+		if (nspecies <= 0)return 0;
+		int width = (nspecies + 1) & ~1;
+		if (width > speciesBufferWidth)
 		{
-			int shift = shifts[i]; //src shift relative to dst
-			if (shift > 0)
+			if (speciesBuffer != NULL)_aligned_free(speciesBuffer);
+			speciesBuffer = (double *)_aligned_malloc((4 * NPS01 * width + 2 * width) * sizeof(double), 32);
+			if (speciesBuffer == NULL)
 			{
-				dcopy(n-shift, sfarray + shift, 1, _tmparr, 1);
+				throw new std::exception("DiffuseMulti: failed to allocate species buffer");
 			}
-			else 
+			speciesBufferWidth = width;
+		}
+		int plane_size = NPS01 * width;
+		double *w0 = speciesBuffer + 4 * plane_size;
+		double *w1 = w0 + width;
+		for (int s = 0; s < width; s++)
+		{
+			double alpha = s < nspecies ? alphas[s] : 0;
+			w0[s] = 1.0 + alpha * coef1;
+			w1[s] = alpha * coef2;
+		}
+
+		double *saved_plane1 = speciesBuffer + 3 * plane_size;
+		double *prev = speciesBuffer;
+		double *cur = speciesBuffer + plane_size;
+		double *next = speciesBuffer + 2 * plane_size;
+		pack_plane(prev, sfarrays, plane_minus(0), nspecies, width);
+		pack_plane(cur, sfarrays, 0, nspecies, width);
+		pack_plane(next, sfarrays, plane_plus(0), nspecies, width);
+		if (isToroidal)
+		{
+			memcpy(saved_plane1, next, plane_size * sizeof(double));
+		}
+
+		for (int k = 0; k < NodesPerSide2; k++)
+		{
+			int offset = k * NPS01;
+			for (int j = 0; j < NodesPerSide1; j++)
 			{
-				dcopy(n, sfarray, 1, _tmparr-shift, 1);
+				int row = j * NodesPerSide0;
+				int row_m = row_minus(j) * NodesPerSide0;
+				int row_p = row_plus(j) * NodesPerSide0;
+				stencil_row_multi(sfarrays, offset + row, cur + row * width, 
+					cur + row_m * width, cur + row_p * width, 
+					prev + row * width, next + row * width, w0, w1, nspecies, width);
 			}
-			//modify slot not folowing rule.
-			int *sindex = lpindex + (i-1)*step2;
-			int *pindex = sindex + step2;
-			int *dindex = sfindex + (i-1)*step2;
+			if (k == NodesPerSide2m1)break;
 
-			while (sindex != pindex)
+			//rotate the ring, the old plane k-1 slot takes plane k+2
+			double *free_slot = prev;
+			prev = cur;
+			cur = next;
+			if (k + 1 == NodesPerSide2m1)
 			{
-				_tmparr[*sindex++] = sfarray[*dindex++];
+				next = isToroidal ? saved_plane1 : prev;
+			}
+			else
+			{
+				next = free_slot;
+				pack_plane(next, sfarrays, k + 2, nspecies, width);
 			}
-			daxpy(n, 1.0, _tmparr, 1, retval, 1);
 		}
-		dscal(n, coef2, retval, 1);
-		daxpy(n, coef1, sfarray, 1, retval, 1);
 		return 0;
 	}
 
+	/***************************************************************************************************
+	 * wavefront (temporal blocking along z) for several explicit steps.
+	 * at wavefront step s, level t computes plane p = s - t + 1, which needs planes p-1, p, p+1
+	 * of level t-1; plane p+1 of level t-1 has been computed earlier in the same step.
+	 * intermediate levels only keep the 3 planes in use. the last level writes plane p to
+	 * sfarray directly, level 1 is at plane p + levels - 1 by then and no longer needs the
+	 * original plane p.
+	 * each z slab runs the pass on its own thread. level t of slab [k0, k1) covers the planes
+	 * [k0 - levels + t, k1 + levels - t), so the last level needs nothing from the other slabs
+	 * but the levels planes of the step start on either side, copied before any slab writes.
+	 * the trapezoid recomputes up to levels - 1 planes per side and level, levels is kept to
+	 * half the slab thickness. the intermediate planes of all slabs share the cache budget.
+	 * for toroidal z, plane 0 would need plane N-2 of every earlier level, so the steps are
+	 * done one at a time instead.
+	 ***************************************************************************************************/
+	int NtInterpolatedRectangularPrism::DiffuseSteps(double *sfarray, double alpha, int nsteps)
+	{
+		if (isToroidal || nsteps < 2)
+		{
+			for (int i = 0; i < nsteps; i++)
+			{
+				MultithreadDiffuse(sfarray, alpha);
+			}
+			return 0;
+		}
 
+		int nslabs = slab_count();
+		int max_levels = WAVEFRONT_CACHE_BYTES / nslabs / (3 * NPS01 * (int)sizeof(double)) + 1;
+		int thickness = NodesPerSide2 / nslabs;
+		if (nslabs > 1 && max_levels > thickness / 2)max_levels = thickness / 2;
+		if (max_levels < 2)max_levels = 2;
 
+		//equal passes, none of a single step
+		int npasses = (nsteps + max_levels - 1) / max_levels;
+		int levels = (nsteps + npasses - 1) / npasses;
+		if (levels > wavefrontLevels)
+		{
+			if (wavefrontBuffer != NULL)_aligned_free(wavefrontBuffer);
+			wavefrontBuffer = (double *)_aligned_malloc(nslabs * (5 * levels - 3) * NPS01 * sizeof(double), 32);
+			if (wavefrontBuffer == NULL)
+			{
+				throw new std::exception("DiffuseSteps: failed to allocate wavefront buffer");
+			}
+			wavefrontLevels = levels;
+		}
 
-	int NtInterpolatedRectangularPrism::NativeRestrict(double *sfarray, double** position, int n, double **_output)
+		double w0 = 1.0 + alpha * coef1;
+		double w1 = alpha * coef2;
+		for (int i = npasses; i > 0; i--)
+		{
+			int k = nsteps / i;
+			run_wavefront_jobs(sfarray, w0, w1, k);
+			nsteps -= k;
+		}
+		return 0;
+	}
+
+	void NtInterpolatedRectangularPrism::run_wavefront_jobs(double *sfarray, double w0, double w1, int levels)
 	{
-		
-		double dx, dy, dz, ddx, ddy, ddz, tmpval;
-		double *pos;
-		double *sfarray_tmp;
-		double StepSizeInverse = 1.0/StepSize;
-		int nps0m1 = NodesPerSide0 - 1;
-		int nps1m1 = NodesPerSide1 - 1;
-		int nps2m1 = NodesPerSide2 - 1;
-		int ishift[8];
-		int ishift1[16];
-		int ishift2[16];
-		int ishift3[16];
-		for (int i=0; i<8; i++)
+		int nslabs = slab_count();
+		int numThreads = nslabs - 1;
+		int slab_planes = 5 * wavefrontLevels - 3;
+
+		EcsRestrictArg main_arg;
+		::InterlockedExchange(&wavefrontPending, nslabs);
+		::InterlockedExchange(&AcitveJobCount, numThreads);
+		for (int i = nslabs - 1; i >= 0; i--)
 		{
-			ishift[i] = array_index_shifts[i];
+			EcsRestrictArg *arg = i < numThreads ? EcsArgs[i] : &main_arg;
+			arg->jobType = JOB_WAVEFRONT;
+			arg->sfarray = sfarray;
+			arg->w0 = w0;
+			arg->w1 = w1;
+			arg->k0 = i * NodesPerSide2 / nslabs;
+			arg->k1 = (i + 1) * NodesPerSide2 / nslabs;
+			arg->n = arg->k1 - arg->k0;
+			arg->levels = levels;
+			arg->buffer = wavefrontBuffer + i * slab_planes * NPS01;
+			arg->haloLo = arg->buffer + 3 * (levels - 1) * NPS01;
+			if (i < numThreads)::SetEvent(JobReadyEvents[i]);
 		}
-		for (int i=0; i< 16; i++)
+
+		run_job(&main_arg);
+		//wait for job finish
+		if (numThreads > 0)
 		{
-			ishift1[i] = array_index_shifts[i+8];
-			ishift2[i] = array_index_shifts[i+24];
-			ishift3[i] = array_index_shifts[i+40];
+			while (::InterlockedCompareExchange(&AcitveJobCount, 1, 0) != 0);
 		}
+	}
 
-#if defined(DO_PREFETCH)
-		int pflist[12];
-		for (int i=0; i<12; i++)
+	void NtInterpolatedRectangularPrism::wavefront_slab(double *sfarray, int k0, int k1, int levels, double w0, double w1, 
+			double *buffer, double *halo)
+	{
+		int lo = k0 - levels > 0 ? k0 - levels : 0;
+		int hi = k1 + levels < NodesPerSide2 ? k1 + levels : NodesPerSide2;
+		for (int q = lo; q < k0; q++)
 		{
-			pflist[i] = sf_prefetch_list[i];
+			memcpy(halo + (q - k0 + levels) * NPS01, sfarray + q * NPS01, NPS01 * sizeof(double));
 		}
-#endif
-	
-		for (int p= 0; p < n; p++)
+		for (int q = k1; q < hi; q++)
 		{
+			memcpy(halo + (q - k1 + levels) * NPS01, sfarray + q * NPS01, NPS01 * sizeof(double));
+		}
+		//no slab writes before all halos are taken
+		::InterlockedDecrement(&wavefrontPending);
+		while (::InterlockedCompareExchange(&wavefrontPending, 0, 0) != 0);
 
-#if defined(DO_PREFETCH)
-			if (p < n-1)
+		int nsweep = hi + levels - 1;
+		for (int s = lo; s < nsweep; s++)
+		{
+			for (int t = 1; t <= levels; t++)
 			{
-				pos =  position[p+1];
-				int pre_index = (int)(pos[0] * StepSizeInverse) + (int)(pos[1] * StepSizeInverse) * NodesPerSide0 + (int)(pos[2] * StepSizeInverse)* NPS01;
-				sfarray_tmp = sfarray + pre_index;
-				for (int x = 0; x < 12; x++)
+				//level t covers [k0 - levels + t, k1 + levels - t) of the grid
+				int p = s - t + 1;
+				if (p < 0 || p < k0 - levels + t || p >= NodesPerSide2 || p >= k1 + levels - t)continue;
+				const double *plane = wavefront_plane(sfarray, t - 1, levels, p, k0, k1, buffer, halo);
+				const double *zm = wavefront_plane(sfarray, t - 1, levels, plane_minus(p), k0, k1, buffer, halo);
+				const double *zp = wavefront_plane(sfarray, t - 1, levels, plane_plus(p), k0, k1, buffer, halo);
+				double *dplane = wavefront_plane(sfarray, t, levels, p, k0, k1, buffer, halo);
+				for (int j = 0; j < NodesPerSide1; j++)
 				{
-					_mm_prefetch((const char *)(sfarray_tmp + pflist[x]), _MM_HINT_T0);
+					int row = j * NodesPerSide0;
+					stencil_row(dplane + row, plane + row, 
+						plane + row_minus(j) * NodesPerSide0, plane + row_plus(j) * NodesPerSide0,
+						zm + row, zp + row, w0, w1);
 				}
-				_mm_prefetch((const char *)(localMatrixArray + pre_index), _MM_HINT_T0);
 			}
-#endif
-			pos = position[p];
-			double *output = _output[p];
+		}
+	}
 
-			tmpval = pos[0] * StepSizeInverse;
-			//tmpval = pos_next;
-			//pos_next = p < n-1 ? position[p+1][0] : 0; //prefetching the next position
-			int idx = (int)tmpval;
-			if (idx == nps0m1)idx--;
-			dx = tmpval - idx;
-			ddx = 1 - dx;
+	/***************************************************************************************************
+	 * factor A = I - theta * r * L for one direction, L being the 1d second difference.
+	 * zero flux: the mirrored neighbour doubles the off diagonal of the first and last rows.
+	 * toroidal: the m = n - 1 unknowns form a cyclic system, with gamma = -b the modified
+	 * tridiagonal T has b[0] - gamma and b[m-1] - a*c/gamma on the diagonal, and
+	 * A^-1 d = y - (y[0] + vfactor * y[m-1]) / (1 + z[0] + vfactor * z[m-1]) * z
+	 * with T y = d, T z = (gamma, 0, ..., 0, c).
+	 ***************************************************************************************************/
+	void NtInterpolatedRectangularPrism::set_adi_factor(NtAdiFactor *f, int n, double r, double theta)
+	{
+		double a = -theta * r;
+		double b = 1.0 + 2.0 * theta * r;
+		double c = -theta * r;
+		f->r = r;
+		f->theta = theta;
+		f->m = isToroidal ? n - 1 : n;
+		int m = f->m;
+		double *lower = f->lower;
+		double *cp = f->cp;
+		double *inv = f->inv;
+
+		if (isToroidal == false)
+		{
+			lower[0] = 0;
+			inv[0] = 1.0 / b;
+			cp[0] = 2 * c * inv[0];
+			for (int j = 1; j < m; j++)
+			{
+				lower[j] = j == m - 1 ? 2 * a : a;
+				inv[j] = 1.0 / (b - lower[j] * cp[j - 1]);
+				cp[j] = j == m - 1 ? 0 : c * inv[j];
+			}
+			return;
+		}
 
-			tmpval = pos[1] * StepSizeInverse;
-			int idy = (int)tmpval;
-			if (idy == nps1m1)idy--;
-			dy = tmpval - idy;
-			ddy = 1 - dy;
+		double gamma = -b;
+		lower[0] = 0;
+		inv[0] = 1.0 / (b - gamma);
+		cp[0] = c * inv[0];
+		for (int j = 1; j < m; j++)
+		{
+			double bj = j == m - 1 ? b - a * c / gamma : b;
+			lower[j] = a;
+			inv[j] = 1.0 / (bj - a * cp[j - 1]);
+			cp[j] = j == m - 1 ? 0 : c * inv[j];
+		}
+		double *z = f->z;
+		z[0] = gamma * inv[0];
+		for (int j = 1; j < m; j++)
+		{
+			double rhs = j == m - 1 ? c : 0;
+			z[j] = (rhs - a * z[j - 1]) * inv[j];
+		}
+		for (int j = m - 2; j >= 0; j--)
+		{
+			z[j] -= cp[j] * z[j + 1];
+		}
+		f->vfactor = a / gamma;
+		f->denom = 1.0 + z[0] + f->vfactor * z[m - 1];
+	}
 
-			tmpval = pos[2] * StepSizeInverse;
-			int idz = (int)tmpval;
-			if (idz == nps2m1)idz--;
-			dz = tmpval - idz;
+	//the explicit half of the theta scheme is fused with the forward elimination, the old
+	//value of node j-1 is kept in work since u[j-1] already holds the eliminated right hand side.
+	void NtInterpolatedRectangularPrism::adi_sweep(double *u, int stride, int width, NtAdiFactor *f, double *work)
+	{
+		int n = f->n;
+		int m = f->m;
+		double re = (1.0 - f->theta) * f->r;
+		double *prev = work;
+		double *first = work + width;
+		if (isToroidal)
+		{
+			memcpy(first, u, width * sizeof(double));
+		}
+
+		for (int j = 0; j < m; j++)
+		{
+			double *uj = u + j * stride;
+			const double *um;
+			const double *up;
+			if (j == 0)um = isToroidal ? u + (n - 2) * stride : u + stride;
+			else um = prev;
+			if (j == n - 1)up = prev; //zero flux only
+			else if (isToroidal && j == m - 1)up = first;
+			else up = uj + stride;
+			double lower = f->lower[j];
+			double inv = f->inv[j];
+			if (j == 0)
+			{
+				for (int i = 0; i < width; i++)
+				{
+					double old = uj[i];
+					prev[i] = old;
+					uj[i] = (old + re * (um[i] - 2 * old + up[i])) * inv;
+				}
+			}
+			else
+			{
+				const double *dm = uj - stride;
+				for (int i = 0; i < width; i++)
+				{
+					double old = uj[i];
+					double rhs = old + re * (um[i] - 2 * old + up[i]);
+					prev[i] = old;
+					uj[i] = (rhs - lower * dm[i]) * inv;
+				}
+			}
+		}
+
+		for (int j = m - 2; j >= 0; j--)
+		{
+			double *uj = u + j * stride;
+			const double *up = uj + stride;
+			double cp = f->cp[j];
+			for (int i = 0; i < width; i++)
+			{
+				uj[i] -= cp * up[i];
+			}
+		}
+
+		if (isToroidal == false)return;
+
+		double *fact = prev;
+		double *ulast = u + (m - 1) * stride;
+		for (int i = 0; i < width; i++)
+		{
+			fact[i] = (u[i] + f->vfactor * ulast[i]) / f->denom;
+		}
+		for (int j = 0; j < m; j++)
+		{
+			double *uj = u + j * stride;
+			double zj = f->z[j];
+			for (int i = 0; i < width; i++)
+			{
+				uj[i] -= fact[i] * zj;
+			}
+		}
+		memcpy(u + m * stride, u, width * sizeof(double));
+	}
+
+	//the three 1d operators commute on the tensor grid, so the product of the 1d
+	//theta steps is a consistent (and for theta >= 1/2 stable) step of the 3d problem.
+	NtAdiFactor *NtInterpolatedRectangularPrism::adi_factors(double alpha, double theta)
+	{
+		for (int e = 0; e < ADI_CACHE_SIZE; e++)
+		{
+			if (adiCache[e].alpha == alpha && adiCache[e].theta == theta)return adiCache[e].factor;
+		}
+
+		NtAdiEntry *entry = &adiCache[adiNext];
+		adiNext = (adiNext + 1) % ADI_CACHE_SIZE;
+		int extents[3] = {NodesPerSide0, NodesPerSide1, NodesPerSide2};
+		if (entry->factor[0].lower == NULL)
+		{
+			//one block for the 3 directions
+			double *block = (double *)malloc(4 * (extents[0] + extents[1] + extents[2]) * sizeof(double));
+			if (block == NULL)
+			{
+				throw new std::exception("DiffuseImplicit: failed to allocate adi factors");
+			}
+			for (int d = 0; d < 3; d++)
+			{
+				int nd = extents[d];
+				NtAdiFactor *f = &entry->factor[d];
+				f->n = nd;
+				f->lower = block;
+				f->cp = f->lower + nd;
+				f->inv = f->cp + nd;
+				f->z = f->inv + nd;
+				block += 4 * nd;
+			}
+		}
+		double r = alpha * coef2;
+		for (int d = 0; d < 3; d++)
+		{
+			set_adi_factor(&entry->factor[d], extents[d], r, theta);
+		}
+		entry->alpha = alpha;
+		entry->theta = theta;
+		return entry->factor;
+	}
+
+	int NtInterpolatedRectangularPrism::DiffuseImplicit(double *sfarray, double alpha, double theta)
+	{
+		NtAdiFactor *adiFactor = adi_factors(alpha, theta);
+
+		//x lines, one row at a time
+		int nrows = NodesPerSide1 * NodesPerSide2;
+		for (int row = 0; row < nrows; row++)
+		{
+			adi_sweep(sfarray + row * NodesPerSide0, 1, 1, &adiFactor[0], planeBuffer);
+		}
+		//y lines, all x lines of a plane together
+		for (int k = 0; k < NodesPerSide2; k++)
+		{
+			adi_sweep(sfarray + k * NPS01, NodesPerSide0, NodesPerSide0, &adiFactor[1], planeBuffer);
+		}
+		//z lines, whole planes together
+		adi_sweep(sfarray, NPS01, NPS01, &adiFactor[2], planeBuffer);
+		return 0;
+	}
+
+	int NtInterpolatedRectangularPrism::DiffuseSpectral(double *sfarray, double alpha)
+	{
+		if (isToroidal == false)
+		{
+			throw new std::exception("DiffuseSpectral: only toroidal grids are supported");
+		}
+		if (spectral == NULL)
+		{
+			int extents[3] = {NodesPerSide0, NodesPerSide1, NodesPerSide2};
+			spectral = new NtSpectralDiffusion(extents, StepSize);
+		}
+		return spectral->Diffuse(sfarray, alpha);
+	}
+
+	//laplacian of the whole grid, n is the array length.
+	//LAPLACIAN_FUSED computes it with the single pass stencil, LAPLACIAN_MULTIPASS
+	//keeps the original shifted copy scheme, which patches the boundary nodes of six shifted
+	//copies of the array, for comparison.
+	int NtInterpolatedRectangularPrism::Laplacian(double *sfarray, double *retval, int n)
+	{ 
+		if (laplacianMethod == LAPLACIAN_FUSED || lpindex == NULL)
+		{
+			stencil_slab(retval, sfarray, 0, NodesPerSide2, coef1, coef2);
+			return 0;
+		}
+
+		dscal(n, 0.0, retval, 1);
+		dscal(n, 0.0, _tmparr, 1);
+
+		int step2 = NodesPerSide0 * NodesPerSide1;
+		int shifts[7] = {0, 1, -1, NodesPerSide0, -NodesPerSide0, step2, -step2};
+		for (int i= 1; i< 7; i++)
+		{
+			int shift = shifts[i]; //src shift relative to dst
+			if (shift > 0)
+			{
+				dcopy(n-shift, sfarray + shift, 1, _tmparr, 1);
+			}
+			else 
+			{
+				dcopy(n, sfarray, 1, _tmparr-shift, 1);
+			}
+			//modify slot not folowing rule.
+			int *sindex = lpindex + (i-1)*step2;
+			int *pindex = sindex + step2;
+			int *dindex = sfindex + (i-1)*step2;
+
+			while (sindex != pindex)
+			{
+				_tmparr[*sindex++] = sfarray[*dindex++];
+			}
+			daxpy(n, 1.0, _tmparr, 1, retval, 1);
+		}
+		dscal(n, coef2, retval, 1);
+		daxpy(n, coef1, sfarray, 1, retval, 1);
+		return 0;
+	}
+
+
+
+
+	int NtInterpolatedRectangularPrism::NativeRestrict(double *sfarray, double** position, int n, double **_output)
+	{
+		
+		double dx, dy, dz, ddx, ddy, ddz, tmpval;
+		double *pos;
+		double *sfarray_tmp;
+		double StepSizeInverse = 1.0/StepSize;
+		int nps0m1 = NodesPerSide0 - 1;
+		int nps1m1 = NodesPerSide1 - 1;
+		int nps2m1 = NodesPerSide2 - 1;
+		int ishift[8];
+		int ishift1[16];
+		int ishift2[16];
+		int ishift3[16];
+		for (int i=0; i<8; i++)
+		{
+			ishift[i] = array_index_shifts[i];
+		}
+		for (int i=0; i< 16; i++)
+		{
+			ishift1[i] = array_index_shifts[i+8];
+			ishift2[i] = array_index_shifts[i+24];
+			ishift3[i] = array_index_shifts[i+40];
+		}
+
+#if defined(DO_PREFETCH)
+		int pflist[12];
+		for (int i=0; i<12; i++)
+		{
+			pflist[i] = sf_prefetch_list[i];
+		}
+#endif
+	
+		for (int p= 0; p < n; p++)
+		{
+
+#if defined(DO_PREFETCH)
+			if (p < n-1)
+			{
+				pos =  position[p+1];
+				int pre_index = (int)(pos[0] * StepSizeInverse) + (int)(pos[1] * StepSizeInverse) * NodesPerSide0 + (int)(pos[2] * StepSizeInverse)* NPS01;
+				sfarray_tmp = sfarray + pre_index;
+				for (int x = 0; x < 12; x++)
+				{
+					_mm_prefetch((const char *)(sfarray_tmp + pflist[x]), _MM_HINT_T0);
+				}
+			}
+#endif
+			pos = position[p];
+			double *output = _output[p];
+
+			tmpval = pos[0] * StepSizeInverse;
+			//tmpval = pos_next;
+			//pos_next = p < n-1 ? position[p+1][0] : 0; //prefetching the next position
+			int idx = (int)tmpval;
+			if (idx == nps0m1)idx--;
+			dx = tmpval - idx;
+			ddx = 1 - dx;
+
+			tmpval = pos[1] * StepSizeInverse;
+			int idy = (int)tmpval;
+			if (idy == nps1m1)idy--;
+			dy = tmpval - idy;
+			ddy = 1 - dy;
+
+			tmpval = pos[2] * StepSizeInverse;
+			int idz = (int)tmpval;
+			if (idz == nps2m1)idz--;
+			dz = tmpval - idz;
 			ddz = 1 - dz;
 
 			int index = idx + idy * NodesPerSide0 + idz * NPS01;
@@ -478,10 +1187,8 @@ namespace NativeDaphneLibrary
 			output[0] = sumval;
 
 			//1th element
-			NtIndexMatrix *lm = localMatrixArray + index;
-			int boundFlag = lm->boundFlag;
 			//handle non-boundary nodes.
-			if (boundFlag == 0)
+			if (idx > 0 && idx < nps0m1 - 1 && idy > 0 && idy < nps1m1 - 1 && idz > 0 && idz < nps2m1 - 1)
 			{
 				sumval = (sfarray_tmp[ishift1[0]] - sfarray_tmp[ishift1[1]]) * coeffs[0];
 				sumval += (sfarray_tmp[ishift1[2]] - sfarray_tmp[ishift1[3]]) * coeffs[1];
@@ -517,7 +1224,23 @@ namespace NativeDaphneLibrary
 			}
 
 			//for boundary node
+			NtIndexMatrix *lm = restrictTable->Cell(idx, idy, idz);
+			int boundFlag = lm->boundFlag;
 			int *index_ptr = lm->indexArray;
+			if (isToroidal)
+			{
+				//central differences with the wrapped neighbours, 8 (plus, minus) pairs per component
+				for (int d = 0; d < 3; d++, index_ptr += 20)
+				{
+					sumval = 0;
+					for (int c = 0; c < 8; c++)
+					{
+						sumval += (sfarray[index_ptr[2 * c]] - sfarray[index_ptr[2 * c + 1]]) * coeffs[c];
+					}
+					output[d + 1] = sumval * gradientFactor;
+				}
+				continue;
+			}
 			if ((boundFlag & XBOUND) == 0)
 			{
 				sumval = (sfarray_tmp[ishift1[0]] - sfarray_tmp[ishift1[1]]) * coeffs[0];
@@ -634,6 +1357,20 @@ namespace NativeDaphneLibrary
 
 	int NtInterpolatedRectangularPrism::MultithreadNativeRestrict(double *sfarray, double** position, int n, double **_output)
 	{
+		//with many positions per node the gradients are computed once per node
+		int job_type = JOB_RESTRICT;
+		int num_nodes = NPS01 * NodesPerSide2;
+		if (restrictStrategy == RESTRICT_FIELD || 
+			(restrictStrategy == RESTRICT_AUTO && (double)n * 100 >= (double)num_nodes * FIELD_RESTRICT_RATIO))
+		{
+			if (restrictField == NULL)
+			{
+				restrictField = (double *)_aligned_malloc(4 * (size_t)num_nodes * sizeof(double), 32);
+			}
+			NodeGradientField(sfarray, restrictField);
+			sfarray = restrictField;
+			job_type = JOB_FIELD_RESTRICT;
+		}
 
 		int numThreads = MaxNumThreads; //total cores -4
 		int NumItemsPerThread = n /(numThreads + 2);
@@ -650,6 +1387,7 @@ namespace NativeDaphneLibrary
 		for (int i=0; i< numThreads; i++)
 		{
 			EcsRestrictArg *arg = EcsArgs[i];
+			arg->jobType = job_type;
 			arg->sfarray = sfarray;
 			arg->position = position + nn;
 			arg->_output = _output + nn;
@@ -658,16 +1396,745 @@ namespace NativeDaphneLibrary
 			::SetEvent(JobReadyEvents[i]);
 		}
 
-		NativeRestrict(sfarray, position, n0, _output);
+		if (job_type == JOB_FIELD_RESTRICT)
+		{
+			FieldRestrict(sfarray, position, n0, _output);
+		}
+		else
+		{
+			NativeRestrictVector(sfarray, position, n0, _output);
+		}
+		//wait for job finish
+		if (numThreads > 0)
+		{
+			while (::InterlockedCompareExchange(&AcitveJobCount, 1, 0) != 0);
+		}
+		return 0;
+
+	}
+
+	int NtInterpolatedRectangularPrism::NodeGradientField(double *sfarray, double *field)
+	{
+		run_slab_jobs(JOB_NODE_GRADIENT, field, sfarray, 0, 0);
+		return 0;
+	}
+
+	//the gradients are stored scaled by gradientFactor, so FieldRestrict() only interpolates
+	void NtInterpolatedRectangularPrism::node_gradient_slab(double *field, const double *sfarray, int k0, int k1)
+	{
+		for (int k = k0; k < k1; k++)
+		{
+			for (int j = 0; j < NodesPerSide1; j++)
+			{
+				int row = j * NodesPerSide0 + k * NPS01;
+				const double *c = sfarray + row;
+				double *out = field + 4 * row;
+				for (int i = 0; i < NodesPerSide0; i++, out += 4)
+				{
+					out[0] = c[i];
+					out[1] = gradientFactor * axis_difference(c + i, i, NodesPerSide0, 1);
+					out[2] = gradientFactor * axis_difference(c + i, j, NodesPerSide1, NodesPerSide0);
+					out[3] = gradientFactor * axis_difference(c + i, k, NodesPerSide2, NPS01);
+				}
+			}
+		}
+	}
+
+	int NtInterpolatedRectangularPrism::FieldRestrict(double *field, double** position, int n, double **_output)
+	{
+		double StepSizeInverse = 1.0/StepSize;
+		int nps0m1 = NodesPerSide0 - 1;
+		int nps1m1 = NodesPerSide1 - 1;
+		int nps2m1 = NodesPerSide2 - 1;
+		int ishift[8];
+		for (int i = 0; i < 8; i++)
+		{
+			ishift[i] = 4 * array_index_shifts[i];
+		}
+
+		for (int p = 0; p < n; p++)
+		{
+			double *pos = position[p];
+			double tmpval = pos[0] * StepSizeInverse;
+			int idx = (int)tmpval;
+			if (idx == nps0m1)idx--;
+			double dx = tmpval - idx;
+			tmpval = pos[1] * StepSizeInverse;
+			int idy = (int)tmpval;
+			if (idy == nps1m1)idy--;
+			double dy = tmpval - idy;
+			tmpval = pos[2] * StepSizeInverse;
+			int idz = (int)tmpval;
+			if (idz == nps2m1)idz--;
+			double dz = tmpval - idz;
+
+			double coeffs[8];
+			coeffs[0] = (1 - dx) * (1 - dy) * (1 - dz);
+			coeffs[1] = (1 - dx) * (1 - dy) * dz;
+			coeffs[2] = (1 - dx) * dy * (1 - dz);
+			coeffs[3] = (1 - dx) * dy * dz;
+			coeffs[4] = dx * (1 - dy) * (1 - dz);
+			coeffs[5] = dx * (1 - dy) * dz;
+			coeffs[6] = dx * dy * (1 - dz);
+			coeffs[7] = dx * dy * dz;
+
+			const double *base = field + 4 * (idx + idy * NodesPerSide0 + idz * NPS01);
+			double *output = _output[p];
+#if defined(USE_SSE)
+			__m128d sum01 = _mm_setzero_pd();
+			__m128d sum23 = _mm_setzero_pd();
+			for (int c = 0; c < 8; c++)
+			{
+				const double *node = base + ishift[c];
+				__m128d w = _mm_set1_pd(coeffs[c]);
+				sum01 = _mm_add_pd(sum01, _mm_mul_pd(w, _mm_loadu_pd(node)));
+				sum23 = _mm_add_pd(sum23, _mm_mul_pd(w, _mm_loadu_pd(node + 2)));
+			}
+			_mm_storeu_pd(output, sum01);
+			_mm_storeu_pd(output + 2, sum23);
+#else
+			output[0] = output[1] = output[2] = output[3] = 0;
+			for (int c = 0; c < 8; c++)
+			{
+				const double *node = base + ishift[c];
+				for (int q = 0; q < 4; q++)
+				{
+					output[q] += coeffs[c] * node[q];
+				}
+			}
+#endif
+		}
+		return 0;
+	}
+
+	int NtInterpolatedRectangularPrism::FieldReduce(double **sfarrays, int nspecies, double *report)
+	{
+		int nslabs = slab_count();
+		int numThreads = nslabs - 1;
+		double *partial = (double *)malloc(nslabs * 3 * nspecies * sizeof(double));
+
+		EcsRestrictArg main_arg;
+		::InterlockedExchange(&AcitveJobCount, numThreads);
+		for (int i = nslabs - 1; i >= 0; i--)
+		{
+			EcsRestrictArg *arg = i < numThreads ? EcsArgs[i] : &main_arg;
+			arg->jobType = JOB_REDUCE;
+			arg->position = sfarrays;
+			arg->n = nspecies;
+			arg->k0 = i * NodesPerSide2 / nslabs;
+			arg->k1 = (i + 1) * NodesPerSide2 / nslabs;
+			arg->dst = partial + i * 3 * nspecies;
+			if (i < numThreads)::SetEvent(JobReadyEvents[i]);
+		}
+
+		run_job(&main_arg);
 		//wait for job finish
 		if (numThreads > 0)
 		{
 			while (::InterlockedCompareExchange(&AcitveJobCount, 1, 0) != 0);
 		}
+
+		//the slabs are combined in order, the result does not depend on the timing
+		double voxel = StepSize * StepSize * StepSize;
+		double volume = NodesPerSide0m1 * StepSize * NodesPerSide1m1 * StepSize * NodesPerSide2m1 * StepSize;
+		for (int s = 0; s < nspecies; s++)
+		{
+			double sum = partial[3 * s];
+			double minval = partial[3 * s + 1];
+			double maxval = partial[3 * s + 2];
+			for (int i = 1; i < nslabs; i++)
+			{
+				double *p = partial + (i * nspecies + s) * 3;
+				sum += p[0];
+				if (p[1] < minval)minval = p[1];
+				if (p[2] > maxval)maxval = p[2];
+			}
+			double *r = report + s * REDUCE_VALUES;
+			r[0] = sum * voxel / 8;
+			r[1] = r[0] / volume;
+			r[2] = minval;
+			r[3] = maxval;
+		}
+		free(partial);
 		return 0;
+	}
 
+	void NtInterpolatedRectangularPrism::reduce_slab(double **sfarrays, int nspecies, int k0, int k1, double *partial)
+	{
+		for (int s = 0; s < nspecies; s++)
+		{
+			const double *sfarray = sfarrays[s];
+			double sum = 0;
+			double minval = sfarray[k0 * NPS01];
+			double maxval = minval;
+			for (int k = k0; k < k1; k++)
+			{
+				double plane = 0;
+				for (int j = 0; j < NodesPerSide1; j++)
+				{
+					double row = reduce_row(sfarray + j * NodesPerSide0 + k * NPS01, &minval, &maxval);
+					plane += j == 0 || j == NodesPerSide1m1 ? row : 2 * row;
+				}
+				sum += k == 0 || k == NodesPerSide2m1 ? plane : 2 * plane;
+			}
+			partial[3 * s] = sum;
+			partial[3 * s + 1] = minval;
+			partial[3 * s + 2] = maxval;
+		}
 	}
 
+	double NtInterpolatedRectangularPrism::reduce_row(const double *c, double *minval, double *maxval)
+	{
+		int n = NodesPerSide0;
+		int i = 0;
+		double sum = 0;
+		double mn = *minval;
+		double mx = *maxval;
+#if defined(USE_SSE)
+		__m128d sum0 = _mm_setzero_pd();
+		__m128d sum1 = _mm_setzero_pd();
+		__m128d vmin = _mm_set1_pd(mn);
+		__m128d vmax = _mm_set1_pd(mx);
+		for (; i + 4 <= n; i += 4)
+		{
+			__m128d a = _mm_loadu_pd(c + i);
+			__m128d b = _mm_loadu_pd(c + i + 2);
+			sum0 = _mm_add_pd(sum0, a);
+			sum1 = _mm_add_pd(sum1, b);
+			vmin = _mm_min_pd(vmin, _mm_min_pd(a, b));
+			vmax = _mm_max_pd(vmax, _mm_max_pd(a, b));
+		}
+		double tmp[2];
+		_mm_storeu_pd(tmp, _mm_add_pd(sum0, sum1));
+		sum = tmp[0] + tmp[1];
+		_mm_storeu_pd(tmp, vmin);
+		mn = tmp[0] < tmp[1] ? tmp[0] : tmp[1];
+		_mm_storeu_pd(tmp, vmax);
+		mx = tmp[0] > tmp[1] ? tmp[0] : tmp[1];
+#endif
+		for (; i < n; i++)
+		{
+			sum += c[i];
+			if (c[i] < mn)mn = c[i];
+			if (c[i] > mx)mx = c[i];
+		}
+		*minval = mn;
+		*maxval = mx;
+		//the end nodes belong to one voxel, the inner nodes to two
+		return 2 * sum - c[0] - c[n - 1];
+	}
+
+	int NtInterpolatedRectangularPrism::NativeDepositFlux(double **position, double *flux, int n, double *dst)
+	{
+		deposit_positions(position, flux, NULL, n, dst, NULL, NULL);
+		return 0;
+	}
+
+	void NtInterpolatedRectangularPrism::deposit_positions(double **position, const double *flux, const int *order, int n, double *dst, 
+		int *cell, double *delta)
+	{
+		double StepSizeInverse = 1.0/StepSize;
+		int nps0m1 = NodesPerSide0 - 1;
+		int nps1m1 = NodesPerSide1 - 1;
+		int nps2m1 = NodesPerSide2 - 1;
+		int ishift[8];
+		for (int i = 0; i < 8; i++)
+		{
+			ishift[i] = array_index_shifts[i];
+		}
+
+		for (int q = 0; q < n; q++)
+		{
+			int p = order != NULL ? order[q] : q;
+			double *pos = position[p];
+			double tmpval = pos[0] * StepSizeInverse;
+			int idx = (int)tmpval;
+			if (idx == nps0m1)idx--;
+			double dx = tmpval - idx;
+			tmpval = pos[1] * StepSizeInverse;
+			int idy = (int)tmpval;
+			if (idy == nps1m1)idy--;
+			double dy = tmpval - idy;
+			tmpval = pos[2] * StepSizeInverse;
+			int idz = (int)tmpval;
+			if (idz == nps2m1)idz--;
+			double dz = tmpval - idz;
+
+			//boundary nodes don't have the full voxel volume
+			double fx0 = idx == 0 ? 2 : 1;
+			double fx1 = idx + 1 == nps0m1 ? 2 : 1;
+			double fy0 = idy == 0 ? 2 : 1;
+			double fy1 = idy + 1 == nps1m1 ? 2 : 1;
+			double fz0 = idz == 0 ? 2 : 1;
+			double fz1 = idz + 1 == nps2m1 ? 2 : 1;
+
+			double wx0 = fx0 * (1 - dx) * flux[p];
+			double wx1 = fx1 * dx * flux[p];
+			double wy0 = fy0 * (1 - dy);
+			double wy1 = fy1 * dy;
+			double wz0 = fz0 * (1 - dz);
+			double wz1 = fz1 * dz;
+
+			int lower = idx + idy * NodesPerSide0 + idz * NPS01;
+			if (cell != NULL)
+			{
+				//the cells NativeRestrictVector() sends to NativeRestrict()
+				bool boundary = idx <= 0 || idx >= NodesPerSide0 - 2 || idy <= 0 || idy >= NodesPerSide1 - 2 || 
+					idz <= 0 || idz >= NodesPerSide2 - 2;
+				cell[q] = boundary ? -1 : lower;
+				delta[3 * q] = dx;
+				delta[3 * q + 1] = dy;
+				delta[3 * q + 2] = dz;
+			}
+
+			//same node order as the coefficients of FieldRestrict()
+			double *base = dst + lower;
+			base[ishift[0]] += wx0 * wy0 * wz0;
+			base[ishift[1]] += wx0 * wy0 * wz1;
+			base[ishift[2]] += wx0 * wy1 * wz0;
+			base[ishift[3]] += wx0 * wy1 * wz1;
+			base[ishift[4]] += wx1 * wy0 * wz0;
+			base[ishift[5]] += wx1 * wy0 * wz1;
+			base[ishift[6]] += wx1 * wy1 * wz0;
+			base[ishift[7]] += wx1 * wy1 * wz1;
+		}
+	}
+
+	/***************************************************************************************************
+	 * the cells of slab s are the cell planes idz with idz * nslabs / ncells == s, its positions write
+	 * node planes [first cell plane, last cell plane + 1]. slabs s and s + 2 are at least one cell
+	 * plane apart, so the slabs of one colour never share a node plane.
+	 ***************************************************************************************************/
+	int NtInterpolatedRectangularPrism::MultithreadDepositFlux(double **position, double *flux, int n, double *dst)
+	{
+		int ncells = NodesPerSide2 - 1;
+		int nslabs = ncells / MIN_SLAB_PLANES;
+		if (nslabs > 2 * (MaxNumThreads + 1))nslabs = 2 * (MaxNumThreads + 1);
+		if (nslabs < 2 || n < MIN_DEPOSIT_POSITIONS)
+		{
+			deposit_positions(position, flux, NULL, n, dst, NULL, NULL);
+			return 0;
+		}
+
+		if (depositCapacity < n + nslabs + 1)
+		{
+			if (depositOrder != NULL)free(depositOrder);
+			depositCapacity = n + nslabs + 1;
+			depositOrder = (int *)malloc(depositCapacity * sizeof(int));
+		}
+		int *order = depositOrder;
+		int *start = depositOrder + n;
+
+		//counting sort by slab, stable so that each node sees the positions in input order
+		double StepSizeInverse = 1.0/StepSize;
+		for (int s = 0; s <= nslabs; s++)start[s] = 0;
+		for (int p = 0; p < n; p++)
+		{
+			int idz = (int)(position[p][2] * StepSizeInverse);
+			if (idz > ncells - 1)idz = ncells - 1;
+			if (idz < 0)idz = 0;
+			start[idz * nslabs / ncells + 1]++;
+		}
+		for (int s = 0; s < nslabs; s++)start[s + 1] += start[s];
+		for (int p = 0; p < n; p++)
+		{
+			int idz = (int)(position[p][2] * StepSizeInverse);
+			if (idz > ncells - 1)idz = ncells - 1;
+			if (idz < 0)idz = 0;
+			order[start[idz * nslabs / ncells]++] = p;
+		}
+		//start[s] is now the end of slab s
+		for (int s = nslabs; s > 0; s--)start[s] = start[s - 1];
+		start[0] = 0;
+
+		for (int colour = 0; colour < 2; colour++)
+		{
+			int njobs = (nslabs - colour + 1) / 2;
+			int numThreads = njobs - 1;
+			EcsRestrictArg main_arg;
+			::InterlockedExchange(&AcitveJobCount, numThreads);
+			for (int i = njobs - 1; i >= 0; i--)
+			{
+				int s = 2 * i + colour;
+				EcsRestrictArg *arg = i < numThreads ? EcsArgs[i] : &main_arg;
+				arg->jobType = JOB_DEPOSIT;
+				arg->position = position;
+				arg->flux = flux;
+				arg->order = order + start[s];
+				arg->n = start[s + 1] - start[s];
+				arg->dst = dst;
+				if (i < numThreads)::SetEvent(JobReadyEvents[i]);
+			}
+
+			run_job(&main_arg);
+			//wait for job finish
+			if (numThreads > 0)
+			{
+				while (::InterlockedCompareExchange(&AcitveJobCount, 1, 0) != 0);
+			}
+		}
+		return 0;
+	}
+
+	//lanes for restrict_cells(). the intrinsics need no /arch switch,
+	//the kernels only run when NtUtility::SimdLevel() reports the instruction set.
+	struct RestrictLanesAvx2
+	{
+		static const int WIDTH = 4;
+		typedef __m256d vec;
+		typedef __m128i ivec;
+		static ivec load_index(const int *p){ return _mm_loadu_si128((const __m128i *)p); }
+		static vec load(const double *p){ return _mm256_loadu_pd(p); }
+		static vec set1(double a){ return _mm256_set1_pd(a); }
+		static vec zero(){ return _mm256_setzero_pd(); }
+		static vec add(vec a, vec b){ return _mm256_add_pd(a, b); }
+		static vec sub(vec a, vec b){ return _mm256_sub_pd(a, b); }
+		static vec mul(vec a, vec b){ return _mm256_mul_pd(a, b); }
+		static vec gather(const double *sf, ivec index, int shift)
+		{
+			return _mm256_i32gather_pd(sf, _mm_add_epi32(index, _mm_set1_epi32(shift)), 8);
+		}
+		static void store(double *p, vec a){ _mm256_storeu_pd(p, a); }
+		static void finish(){ _mm256_zeroupper(); }
+	};
+
+	struct RestrictLanesAvx512
+	{
+		static const int WIDTH = 8;
+		typedef __m512d vec;
+		typedef __m256i ivec;
+		static ivec load_index(const int *p){ return _mm256_loadu_si256((const __m256i *)p); }
+		static vec load(const double *p){ return _mm512_loadu_pd(p); }
+		static vec set1(double a){ return _mm512_set1_pd(a); }
+		static vec zero(){ return _mm512_setzero_pd(); }
+		static vec add(vec a, vec b){ return _mm512_add_pd(a, b); }
+		static vec sub(vec a, vec b){ return _mm512_sub_pd(a, b); }
+		static vec mul(vec a, vec b){ return _mm512_mul_pd(a, b); }
+		static vec gather(const double *sf, ivec index, int shift)
+		{
+			return _mm512_i32gather_pd(_mm256_add_epi32(index, _mm256_set1_epi32(shift)), sf, 8);
+		}
+		static void store(double *p, vec a){ _mm512_storeu_pd(p, a); }
+		static void finish(){ _mm256_zeroupper(); }
+	};
+
+	/***************************************************************************************************
+	 * interior cells of NativeRestrict(), one cell per lane.
+	 * the 56 shifted reads of the scalar code touch 32 distinct nodes: the 4 x 4 nodes of the x lines
+	 * through the cell (x = -1 .. 2) and the 8 + 8 nodes just outside the cell in y and z.
+	 * these are gathered once, the sums run in the same order as the scalar code.
+	 ***************************************************************************************************/
+	template <class Lanes>
+	void NtInterpolatedRectangularPrism::restrict_cells(const double *sfarray, const int *index, const double *delta, double **output)
+	{
+		typedef typename Lanes::vec vec;
+		const int W = Lanes::WIDTH;
+		typename Lanes::ivec vindex = Lanes::load_index(index);
+		vec one = Lanes::set1(1.0);
+		vec dx = Lanes::load(delta);
+		vec dy = Lanes::load(delta + W);
+		vec dz = Lanes::load(delta + 2 * W);
+		vec wx[2] = {Lanes::sub(one, dx), dx};
+		vec wy[2] = {Lanes::sub(one, dy), dy};
+		vec wz[2] = {Lanes::sub(one, dz), dz};
+
+		//xline[dj][dk][a] is node (a - 1, dj, dk)
+		vec xline[2][2][4];
+		//ym/yp[di][dk] are nodes (di, -1, dk) and (di, 2, dk), zm/zp[di][dj] likewise
+		vec ym[2][2], yp[2][2], zm[2][2], zp[2][2];
+		for (int u = 0; u < 2; u++)
+		{
+			for (int v = 0; v < 2; v++)
+			{
+				for (int a = 0; a < 4; a++)
+				{
+					xline[u][v][a] = Lanes::gather(sfarray, vindex, a - 1 + u * NodesPerSide0 + v * NPS01);
+				}
+				ym[u][v] = Lanes::gather(sfarray, vindex, u - NodesPerSide0 + v * NPS01);
+				yp[u][v] = Lanes::gather(sfarray, vindex, u + 2 * NodesPerSide0 + v * NPS01);
+				zm[u][v] = Lanes::gather(sfarray, vindex, u + v * NodesPerSide0 - NPS01);
+				zp[u][v] = Lanes::gather(sfarray, vindex, u + v * NodesPerSide0 + 2 * NPS01);
+			}
+		}
+
+		vec value = Lanes::zero();
+		vec gx = Lanes::zero();
+		vec gy = Lanes::zero();
+		vec gz = Lanes::zero();
+		for (int c = 0; c < 8; c++)
+		{
+			int di = c >> 2, dj = (c >> 1) & 1, dk = c & 1;
+			vec w = Lanes::mul(Lanes::mul(wx[di], wy[dj]), wz[dk]);
+			value = Lanes::add(value, Lanes::mul(xline[dj][dk][di + 1], w));
+			gx = Lanes::add(gx, Lanes::mul(Lanes::sub(xline[dj][dk][di + 2], xline[dj][dk][di]), w));
+			vec yplus = dj == 0 ? xline[1][dk][di + 1] : yp[di][dk];
+			vec yminus = dj == 0 ? ym[di][dk] : xline[0][dk][di + 1];
+			gy = Lanes::add(gy, Lanes::mul(Lanes::sub(yplus, yminus), w));
+			vec zplus = dk == 0 ? xline[dj][1][di + 1] : zp[di][dj];
+			vec zminus = dk == 0 ? zm[di][dj] : xline[dj][0][di + 1];
+			gz = Lanes::add(gz, Lanes::mul(Lanes::sub(zplus, zminus), w));
+		}
+		vec factor = Lanes::set1(gradientFactor);
+		double out[4 * W];
+		Lanes::store(out, value);
+		Lanes::store(out + W, Lanes::mul(gx, factor));
+		Lanes::store(out + 2 * W, Lanes::mul(gy, factor));
+		Lanes::store(out + 3 * W, Lanes::mul(gz, factor));
+		Lanes::finish();
+		for (int l = 0; l < W; l++)
+		{
+			double *dst = output[l];
+			dst[0] = out[l];
+			dst[1] = out[W + l];
+			dst[2] = out[2 * W + l];
+			dst[3] = out[3 * W + l];
+		}
+	}
+
+	int NtInterpolatedRectangularPrism::NativeRestrictVector(double *sfarray, double** position, int n, double **output)
+	{
+		if (simdLevel == NtUtility::SIMD_NONE)
+		{
+			return NativeRestrict(sfarray, position, n, output);
+		}
+
+		int width = simdLevel == NtUtility::SIMD_AVX512 ? RestrictLanesAvx512::WIDTH : RestrictLanesAvx2::WIDTH;
+		double StepSizeInverse = 1.0/StepSize;
+		int index[8];
+		double delta[24];
+		double *pending[8];
+		double *out[8];
+		int m = 0;
+		for (int p = 0; p < n; p++)
+		{
+			double *pos = position[p];
+			double tx = pos[0] * StepSizeInverse;
+			double ty = pos[1] * StepSizeInverse;
+			double tz = pos[2] * StepSizeInverse;
+			int idx = (int)tx;
+			int idy = (int)ty;
+			int idz = (int)tz;
+			//cells touching the boundary, including the clamped last node
+			if (idx <= 0 || idx >= NodesPerSide0 - 2 || idy <= 0 || idy >= NodesPerSide1 - 2 || idz <= 0 || idz >= NodesPerSide2 - 2)
+			{
+				NativeRestrict(sfarray, position + p, 1, output + p);
+				continue;
+			}
+			index[m] = idx + idy * NodesPerSide0 + idz * NPS01;
+			delta[m] = tx - idx;
+			delta[width + m] = ty - idy;
+			delta[2 * width + m] = tz - idz;
+			pending[m] = pos;
+			out[m++] = output[p];
+			if (m == width)
+			{
+				if (width == RestrictLanesAvx512::WIDTH)
+				{
+					restrict_cells<RestrictLanesAvx512>(sfarray, index, delta, out);
+				}
+				else
+				{
+					restrict_cells<RestrictLanesAvx2>(sfarray, index, delta, out);
+				}
+				m = 0;
+			}
+		}
+		NativeRestrict(sfarray, pending, m, out);
+		return 0;
+	}
+
+
+	int NtInterpolatedRectangularPrism::NativeExchange(double *sfarray, double **position, double *flux, int n, double **output)
+	{
+		sort_cell_planes(position, flux, output, n);
+		exchange_slab(sfarray, 0, NodesPerSide2 - 1);
+		exchange_edges(sfarray, 0, NodesPerSide2 - 1);
+		return 0;
+	}
+
+	int NtInterpolatedRectangularPrism::MultithreadExchange(double *sfarray, double **position, double *flux, int n, double **output)
+	{
+		int ncells = NodesPerSide2 - 1;
+		int nslabs = ncells / MIN_SLAB_PLANES;
+		if (nslabs > 2 * (MaxNumThreads + 1))nslabs = 2 * (MaxNumThreads + 1);
+		if (nslabs < 2 || n < MIN_DEPOSIT_POSITIONS)
+		{
+			return NativeExchange(sfarray, position, flux, n, output);
+		}
+
+		sort_cell_planes(position, flux, output, n);
+		exchangeSlabs = nslabs;
+		//even slabs, odd slabs, then the edges of two neighbouring slabs per job
+		run_exchange_jobs(JOB_EXCHANGE, 0, 2, 1, sfarray);
+		run_exchange_jobs(JOB_EXCHANGE, 1, 2, 1, sfarray);
+		run_exchange_jobs(JOB_EXCHANGE_EDGE, 0, 2, 2, sfarray);
+		exchangeSlabs = 1;
+		return 0;
+	}
+
+	void NtInterpolatedRectangularPrism::run_exchange_jobs(int job_type, int first, int stride, int width, double *sfarray)
+	{
+		int njobs = (exchangeSlabs - first + stride - 1) / stride;
+		int numThreads = njobs - 1;
+		EcsRestrictArg main_arg;
+		::InterlockedExchange(&AcitveJobCount, numThreads);
+		for (int i = njobs - 1; i >= 0; i--)
+		{
+			EcsRestrictArg *arg = i < numThreads ? EcsArgs[i] : &main_arg;
+			arg->jobType = job_type;
+			arg->sfarray = sfarray;
+			arg->k0 = first + i * stride;
+			arg->k1 = arg->k0 + width < exchangeSlabs ? arg->k0 + width : exchangeSlabs;
+			arg->n = arg->k1 - arg->k0;
+			if (i < numThreads)::SetEvent(JobReadyEvents[i]);
+		}
+
+		run_job(&main_arg);
+		//wait for job finish
+		if (numThreads > 0)
+		{
+			while (::InterlockedCompareExchange(&AcitveJobCount, 1, 0) != 0);
+		}
+	}
+
+	//the copies make the exchange a sequential pass over its inputs, only the grid
+	//and the output arrays are visited in cell plane order
+	void NtInterpolatedRectangularPrism::sort_cell_planes(double **position, double *flux, double **output, int n)
+	{
+		int ncells = NodesPerSide2 - 1;
+		if (exchangeCapacity < n)
+		{
+			if (exchangePosition != NULL)
+			{
+				free(exchangePosition);
+				free(exchangePointer);
+				free(exchangeFlux);
+				free(exchangeOutput);
+				free(exchangeIndex);
+				free(exchangeDelta);
+			}
+			exchangeCapacity = n;
+			exchangePosition = (double *)malloc(3 * n * sizeof(double));
+			exchangePointer = (double **)malloc(n * sizeof(double *));
+			exchangeFlux = (double *)malloc(n * sizeof(double));
+			exchangeOutput = (double **)malloc(n * sizeof(double *));
+			exchangeIndex = (int *)malloc(n * sizeof(int));
+			exchangeDelta = (double *)malloc(3 * n * sizeof(double));
+			for (int q = 0; q < n; q++)
+			{
+				exchangePointer[q] = exchangePosition + 3 * q;
+			}
+		}
+		if (depositCapacity < ncells + 1)
+		{
+			if (depositOrder != NULL)free(depositOrder);
+			depositCapacity = ncells + 1;
+			depositOrder = (int *)malloc(depositCapacity * sizeof(int));
+		}
+		exchangeStart = depositOrder;
+
+		double StepSizeInverse = 1.0/StepSize;
+		int *start = exchangeStart;
+		for (int k = 0; k <= ncells; k++)start[k] = 0;
+		for (int p = 0; p < n; p++)
+		{
+			int idz = (int)(position[p][2] * StepSizeInverse);
+			if (idz > ncells - 1)idz = ncells - 1;
+			if (idz < 0)idz = 0;
+			start[idz + 1]++;
+		}
+		for (int k = 0; k < ncells; k++)start[k + 1] += start[k];
+		for (int p = 0; p < n; p++)
+		{
+			double *pos = position[p];
+			int idz = (int)(pos[2] * StepSizeInverse);
+			if (idz > ncells - 1)idz = ncells - 1;
+			if (idz < 0)idz = 0;
+			int q = start[idz]++;
+			exchangePosition[3 * q] = pos[0];
+			exchangePosition[3 * q + 1] = pos[1];
+			exchangePosition[3 * q + 2] = pos[2];
+			exchangeFlux[q] = flux[p];
+			exchangeOutput[q] = output[p];
+		}
+		for (int k = ncells; k > 0; k--)start[k] = start[k - 1];
+		start[0] = 0;
+	}
+
+	/***************************************************************************************************
+	 * the restrict of cell plane g reads node planes g - 1 .. g + 2 (the gradients at nodes g and g + 1),
+	 * which get deposits from cell planes g - 2 .. g + 2. so plane g is restricted right after the
+	 * deposit of plane g + 2, while its nodes are still in cache. for planes within 2 of the slab ends
+	 * some of these deposits belong to the neighbouring slabs (or wrap around for toroidal grids),
+	 * they are left to exchange_edges().
+	 ***************************************************************************************************/
+	void NtInterpolatedRectangularPrism::exchange_slab(double *sfarray, int k0, int k1)
+	{
+		int *start = exchangeStart;
+		for (int k = k0; k < k1; k++)
+		{
+			int q0 = start[k];
+			deposit_positions(exchangePointer + q0, exchangeFlux + q0, NULL, start[k + 1] - q0, sfarray, 
+				exchangeIndex + q0, exchangeDelta + 3 * q0);
+			int g = k - 2;
+			if (g >= k0 + 2 && g < k1 - 2)
+			{
+				restrict_recorded(sfarray, start[g], start[g + 1]);
+			}
+		}
+	}
+
+	void NtInterpolatedRectangularPrism::exchange_edges(double *sfarray, int k0, int k1)
+	{
+		int *start = exchangeStart;
+		int lo = k0 + 2 < k1 ? k0 + 2 : k1;
+		int hi = k1 - 2 > lo ? k1 - 2 : lo;
+		restrict_recorded(sfarray, start[k0], start[lo]);
+		restrict_recorded(sfarray, start[hi], start[k1]);
+	}
+
+	void NtInterpolatedRectangularPrism::restrict_recorded(double *sfarray, int q0, int q1)
+	{
+		if (simdLevel == NtUtility::SIMD_NONE)
+		{
+			NativeRestrict(sfarray, exchangePointer + q0, q1 - q0, exchangeOutput + q0);
+			return;
+		}
+
+		int width = simdLevel == NtUtility::SIMD_AVX512 ? RestrictLanesAvx512::WIDTH : RestrictLanesAvx2::WIDTH;
+		int index[8];
+		double delta[24];
+		double *pending[8];
+		double *out[8];
+		int m = 0;
+		for (int q = q0; q < q1; q++)
+		{
+			if (exchangeIndex[q] < 0)
+			{
+				NativeRestrict(sfarray, exchangePointer + q, 1, exchangeOutput + q);
+				continue;
+			}
+			index[m] = exchangeIndex[q];
+			delta[m] = exchangeDelta[3 * q];
+			delta[width + m] = exchangeDelta[3 * q + 1];
+			delta[2 * width + m] = exchangeDelta[3 * q + 2];
+			pending[m] = exchangePointer[q];
+			out[m++] = exchangeOutput[q];
+			if (m == width)
+			{
+				if (width == RestrictLanesAvx512::WIDTH)
+				{
+					restrict_cells<RestrictLanesAvx512>(sfarray, index, delta, out);
+				}
+				else
+				{
+					restrict_cells<RestrictLanesAvx2>(sfarray, index, delta, out);
+				}
+				m = 0;
+			}
+		}
+		NativeRestrict(sfarray, pending, m, out);
+	}
 
 	int NtInterpolatedRectangularPrism::TestAddition(int a, int b)
 	{
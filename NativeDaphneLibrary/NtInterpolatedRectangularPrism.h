@@ -24,19 +24,38 @@ THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <stdlib.h>
 #include <stdio.h>
 #include <process.h>
-
+#include "NtOperatorCache.h"
 
 namespace NativeDaphneLibrary
 {
-	//this class stores precomputed gradientMatrix information
-	//indexArray stores 20 x 3 indexes for the 3 gradient matrix components
-	typedef struct DllExport NtIndexMatrix
+	//tridiagonal system (I - theta * alpha * L) for the lines along one direction,
+	//factored once and shared by all lines. for toroidal lines the last node is the
+	//first one, the m = n - 1 unknowns form a cyclic system solved by Sherman-Morrison.
+	typedef struct DllExport NtAdiFactor
+	{
+		int n;			//nodes per line
+		int m;			//unknowns per line
+		double r;		//alpha / h^2
+		double theta;	//1/2 crank-nicolson, 1 backward euler
+		double *lower;	//sub diagonal
+		double *cp;		//modified super diagonal
+		double *inv;	//inverse pivots
+		double *z;		//cyclic correction vector
+		double vfactor;	//weight of the last unknown in the correction
+		double denom;	//1 + v.z
+	}NtAdiFactorStr;
+
+	//factors for the x, y and z lines of one (alpha, theta)
+	typedef struct DllExport NtAdiEntry
 	{
-		int boundFlag;
-		int indexArray[60]; 
-	}NtIndexMatrixStr;
+		double alpha;
+		double theta;
+		NtAdiFactor factor[3];
+	}NtAdiEntryStr;
 
 	class NtInterpolatedRectangularPrism;
+	class NtSpectralDiffusion;
+	class NtActiveRegion;
 
 	class DllExport EcsRestrictArg
 	{
@@ -47,6 +66,24 @@ namespace NativeDaphneLibrary
 		int n; 
 		double **_output;
 		int threadId;
+		//see NtInterpolatedRectangularPrism::JOB_*
+		int jobType;
+		//for the slab jobs, planes [k0, k1)
+		int k0;
+		int k1;
+		double *dst;
+		double w0;
+		double w1;
+		double *haloLo;
+		double *haloHi;
+		double *buffer;
+		//for the active tile jobs, tiles [k0, k1) of the active list
+		NtActiveRegion *region;
+		//for the deposit jobs, the amounts and the positions of the slab
+		const double *flux;
+		const int *order;
+		//for the wavefront jobs, the number of time levels
+		int levels;
 	};
 
 	class DllExport NtInterpolatedRectangularPrism
@@ -81,20 +118,78 @@ namespace NativeDaphneLibrary
 
 		double *_tmparr;
 
+		//laplacian kernel selection, see SetLaplacianMethod()
+		int laplacianMethod;
+
+		//restrict strategy, see SetRestrictStrategy()
+		int restrictStrategy;
+		//value and prescaled node gradient, 4 doubles per node, created on first use
+		double *restrictField;
+
+		//MultithreadDepositFlux() positions sorted by z slab, grown on demand
+		int *depositOrder;
+		int depositCapacity;
+
+		//NativeExchange() state, the positions, fluxes and outputs copied in cell plane order,
+		//exchangeStart[k] is the first one of plane k. per sorted position the lower node
+		//(-1 for the boundary cells) and dx, dy, dz recorded by the deposit.
+		int *exchangeStart;
+		double *exchangePosition;
+		double **exchangePointer;
+		double *exchangeFlux;
+		double **exchangeOutput;
+		int *exchangeIndex;
+		double *exchangeDelta;
+		int exchangeCapacity;
+		int exchangeSlabs;
+
+		//number of rows processed per z sweep by the fused stencil,
+		//chosen so that the block rows of the 3 planes in use stay in L2
+		int stencilRowBlock;
+
+		//plane buffer for Diffuse(), two planes in flight plus the two halo planes
+		double *planeBuffer;
+
+		//per slab buffers (4 planes each) for MultithreadDiffuse()
+		double *slabBuffer;
+
+		//species interleaved plane buffers for DiffuseMulti(), 4 planes of
+		//NPS01 nodes with speciesBufferWidth values per node
+		double *speciesBuffer;
+		int speciesBufferWidth;
+
+		//for DiffuseImplicit(), the factors of the last ADI_CACHE_SIZE (alpha, theta),
+		//one per species and scheme in use. replaced round robin, allocated on first use.
+		static const int ADI_CACHE_SIZE = 8;
+		NtAdiEntry adiCache[ADI_CACHE_SIZE];
+		int adiNext;
+
+		//for DiffuseSteps(), per slab 3 planes for each intermediate time level
+		//and the levels planes of the step start below and above the slab
+		double *wavefrontBuffer;
+		int wavefrontLevels;
+		//slabs still copying their halo planes in a wavefront pass
+		unsigned long wavefrontPending;
+
+		//for DiffuseSpectral(), created on first use
+		NtSpectralDiffusion *spectral;
+
 		//for laplacianv0 only
 		int *lpindex_inbound;
 		int *sfindex_inbound;
 		int inbound_length;
 
 		//data for restrict
-		//precomputed localmatrix informaiton
-		NtIndexMatrix *localMatrixArray;
+		//precomputed localmatrix informaiton of the boundary cells, shared through NtOperatorCache.
+		//interior cells use array_index_shifts.
+		NtRestrictTable *restrictTable;
 		bool isToroidal;
 		int NPS01;  //NodesPerSide0 * NodesPerSide1;
 		//more precomputed values.
 		int sf_prefetch_list[12];
 		int array_index_shifts[56];
-
+		//NtUtility::SimdLevel(), picks the NativeRestrictVector() kernel
+		int simdLevel;
 
 
 		int num_restrict_node;
@@ -118,28 +213,289 @@ namespace NativeDaphneLibrary
 
 	public:
 
+		//multipass dcopy/daxpy laplacian using the lpindex/sfindex patch-up,
+		//requires initialize_laplacian()
+		static const int LAPLACIAN_MULTIPASS = 0;
+		//single pass 7-point stencil, see stencil_slab()
+		static const int LAPLACIAN_FUSED = 1;
+
+		//cache budget for the row block of the fused stencil
+		static const int STENCIL_CACHE_BYTES = 256 * 1024;
+		//worker job types
+		static const int JOB_RESTRICT = 0;
+		static const int JOB_LAPLACIAN = 1;
+		static const int JOB_DIFFUSE = 2;
+		static const int JOB_FIRST_TOUCH = 3;
+		static const int JOB_ACTIVE_DIFFUSE = 4;
+		static const int JOB_ACTIVE_WRITE = 5;
+		//NodeGradientField() slabs and FieldRestrict() positions
+		static const int JOB_NODE_GRADIENT = 6;
+		static const int JOB_FIELD_RESTRICT = 7;
+		//DepositFlux() positions of one z slab
+		static const int JOB_DEPOSIT = 8;
+		//NativeExchange() slabs [k0, k1) and the restrict of their edge planes
+		static const int JOB_EXCHANGE = 9;
+		static const int JOB_EXCHANGE_EDGE = 10;
+		//FieldReduce() partial sums of a z slab
+		static const int JOB_REDUCE = 11;
+		//DiffuseSteps() wavefront pass of one z slab
+		static const int JOB_WAVEFRONT = 12;
+
+		//values per species in the FieldReduce() report: integral, mean, min and max
+		static const int REDUCE_VALUES = 4;
+
+		//MultithreadNativeRestrict() per cell, from the node gradient field or picked by the
+		//number of positions: the field pays off once there are FIELD_RESTRICT_RATIO
+		//positions or more per 100 nodes
+		static const int RESTRICT_CELLS = 0;
+		static const int RESTRICT_FIELD = 1;
+		static const int RESTRICT_AUTO = 2;
+		static const int FIELD_RESTRICT_RATIO = 25;
+
+		//minimum number of planes in a z slab for the multithreaded stencil
+		static const int MIN_SLAB_PLANES = 4;
+		//minimum number of active tiles per thread
+		static const int MIN_JOB_TILES = 8;
+		//below this number of positions MultithreadDepositFlux() runs on the calling thread
+		static const int MIN_DEPOSIT_POSITIONS = 256;
+
+		//cache budget for the plane buffers of the DiffuseSteps() wavefront
+		static const int WAVEFRONT_CACHE_BYTES = 8 * 1024 * 1024;
+
 		NtInterpolatedRectangularPrism();
 
 		NtInterpolatedRectangularPrism(int* extents, double step_size, bool is_toroidal);
 
 		~NtInterpolatedRectangularPrism();
 
-		void initialize_index_matrix(int index);
 
 		void initialize_laplacian(int* index_operator, double _coef1, double _coef2);
 
 		int Laplacian(double *sfarray, double *retval, int n);
 
+		//select the kernel used by Laplacian(), returns the previous method.
+		//the multipass method falls back to the fused one if initialize_laplacian()
+		//was never called.
+		int SetLaplacianMethod(int method);
+
+		//select the MultithreadNativeRestrict() strategy, returns the previous one
+		int SetRestrictStrategy(int strategy);
+
+		//in place sfarray += alpha * laplacian(sfarray), alpha = D * dt.
+		//one streaming pass over the grid, no laplacian array is needed.
+		int Diffuse(double *sfarray, double alpha);
+
+		//Diffuse() for nspecies arrays in one sweep, sfarrays[s] += alphas[s] * laplacian(sfarrays[s]).
+		//the planes are packed species-interleaved so that the SIMD lanes run across species.
+		int DiffuseMulti(double **sfarrays, double *alphas, int nspecies);
+
+		//Laplacian() and Diffuse() split into z slabs over the worker threads
+		int MultithreadLaplacian(double *sfarray, double *retval, int n);
+
+		int MultithreadDiffuse(double *sfarray, double alpha);
+
+		//copy src to dst slab by slab on the worker threads, so that the pages of a newly
+		//allocated dst are first touched by the thread that will update them.
+		int FirstTouchCopy(double *dst, double *src);
+
+		//Diffuse() restricted to the active tiles of region, the uniform tiles are skipped.
+		//region is re-evaluated before the update and its changed tiles marked afterwards.
+		int DiffuseActive(double *sfarray, double alpha, NtActiveRegion *region);
+
+		//nsteps Diffuse() steps, with the time levels of several steps advanced together
+		//along z so that the grid is streamed from memory about once per pass.
+		//each z slab runs its own wavefront on a worker thread.
+		int DiffuseSteps(double *sfarray, double alpha, int nsteps);
+
+		//implicit Diffuse(), one theta scheme solve per direction (locally one dimensional adi).
+		//unconditionally stable, theta = 0.5 is crank-nicolson and theta = 1 backward euler.
+		int DiffuseImplicit(double *sfarray, double alpha, double theta);
+
+		//exact Diffuse() by fft for toroidal grids, see NtSpectralDiffusion.
+		int DiffuseSpectral(double *sfarray, double alpha);
+
 		int NativeRestrict(double *sfarray, double** pos, int n, double **output);
 
 		int NtInterpolatedRectangularPrism::thread_restrict( void* arg);
 
 		int MultithreadNativeRestrict(double *sfarray, double** position, int n, double **_output);
+
+		//NativeRestrict() with the interior cells done 4 (AVX2) or 8 (AVX-512) at a time with gathers,
+		//boundary cells and the remainder go through NativeRestrict(). without AVX2 it is NativeRestrict().
+		int NativeRestrictVector(double *sfarray, double** position, int n, double **output);
+
+		//field[4 * node] holds the value and the gradient at every node, the same node gradients
+		//NativeRestrict() interpolates. one streaming pass, split into z slabs over the workers.
+		int NodeGradientField(double *sfarray, double *field);
+
+		//NativeRestrict() as trilinear interpolation of a field made by NodeGradientField()
+		int FieldRestrict(double *field, double** position, int n, double **output);
+
+		//scatter of the boundary flux sources, the transpose of the trilinear interpolation.
+		//for every position dst[node] += volFactor * weight * flux[p], volFactor doubles for
+		//each axis on which the node lies on the boundary, see NodeInterpolator::DiffusionFlux().
+		int NativeDepositFlux(double **position, double *flux, int n, double *dst);
+
+		//NativeDepositFlux() over the worker threads. the positions are sorted into z slabs of cells,
+		//the even slabs run first and then the odd ones, so that no two slabs running at the same
+		//time write the same plane. each node is updated in a fixed order, no buffers or atomics.
+		int MultithreadDepositFlux(double **position, double *flux, int n, double *dst);
+
+		//integral, mean, min and max of nspecies fields in one pass over the z slabs, REDUCE_VALUES
+		//per species in report. the integral is the sum of the voxel centre values (the average of
+		//the 8 corner nodes) times the voxel volume, i.e. the node values weighted by 1 or 2 per axis
+		//for the end and inner nodes. min and max are over the nodes, which bound the trilinear field.
+		int FieldReduce(double **sfarrays, int nspecies, double *report);
+
+		//NativeDepositFlux() followed by NativeRestrictVector() at the same positions in one visit.
+		//the positions are taken by cell plane, the restrict of a plane runs 2 planes behind the
+		//deposit, when all deposits its stencil reads are done, and reuses the node index and weights
+		//of the deposit. same result as the two calls, up to the order of the deposit sums.
+		int NativeExchange(double *sfarray, double **position, double *flux, int n, double **output);
+
+		//NativeExchange() over z slabs of cells, the even slabs and then the odd ones. the restrict
+		//of the 2 cell planes at either end of a slab needs the neighbouring slabs and runs last.
+		int MultithreadExchange(double *sfarray, double **position, double *flux, int n, double **output);
 	
 		//for testing access
 		int TestAddition(int a, int b);
 
 	private:
+
+		//dst[i] = w0 * c[i] + w1 * (sum of the 6 neighbours of c[i]) for one x row.
+		//ym/yp/zm/zp are the neighbouring rows already resolved for boundary/toroidal,
+		//the two x edge nodes are peeled off. dst must not alias any of the inputs.
+		void stencil_row(double *dst, const double *c, const double *ym, const double *yp, 
+			const double *zm, const double *zp, double w0, double w1);
+
+		//stencil_row() over species-interleaved rows, each node holding width values.
+		//the result for species s is written to dst[s][offset + i].
+		void stencil_row_multi(double **dst, int offset, const double *c, const double *ym, const double *yp, 
+			const double *zm, const double *zp, const double *w0, const double *w1, int nspecies, int width);
+
+		//copy plane k of the species arrays into the interleaved buffer dst
+		void pack_plane(double *dst, double **sfarrays, int k, int nspecies, int width);
+
+		//levels time steps in one wavefront pass over the z slabs, levels >= 2
+		void run_wavefront_jobs(double *sfarray, double w0, double w1, int levels);
+
+		//wavefront pass of planes [k0, k1), buffer holds the intermediate levels and
+		//halo the 2 * levels planes of the step start around the slab
+		void wavefront_slab(double *sfarray, int k0, int k1, int levels, double w0, double w1, 
+			double *buffer, double *halo);
+
+		//plane q of time level t in the wavefront pass of slab [k0, k1). level 0 is sfarray
+		//inside the slab and the halo outside, the last level is sfarray.
+		double *wavefront_plane(double *sfarray, int t, int levels, int q, int k0, int k1, 
+			double *buffer, double *halo)
+		{
+			if (t == levels || (t == 0 && q >= k0 && q < k1))return sfarray + q * NPS01;
+			if (t == 0)return halo + (q < k0 ? q - k0 + levels : q - k1 + levels) * NPS01;
+			return buffer + ((t - 1) * 3 + q % 3) * NPS01;
+		}
+
+		//factor the tridiagonal system for the lines of n nodes
+		void set_adi_factor(NtAdiFactor *f, int n, double r, double theta);
+
+		//x, y and z factors for (alpha, theta), from adiCache or computed into its next slot
+		NtAdiFactor *adi_factors(double alpha, double theta);
+
+		//one theta scheme step along the lines of f, element j of line i at u[i + j * stride], i < width.
+		//work needs 2 * width doubles.
+		void adi_sweep(double *u, int stride, int width, NtAdiFactor *f, double *work);
+
+		//in place diffusion of planes [k0, k1), halo_lo/halo_hi are copies of the
+		//old neighbouring planes below k0 and above k1 - 1. buffer holds 2 planes.
+		void diffuse_slab(double *sfarray, int k0, int k1, double w0, double w1, 
+			const double *halo_lo, const double *halo_hi, double *buffer);
+
+		//number of z slabs (and threads) used by run_slab_jobs()
+		int slab_count()
+		{
+			int nslabs = NodesPerSide2 / MIN_SLAB_PLANES;
+			if (nslabs > MaxNumThreads + 1)nslabs = MaxNumThreads + 1;
+			if (nslabs < 1)nslabs = 1;
+			return nslabs;
+		}
+
+		//run a JOB_* over the z slabs, the calling thread takes the last slab
+		void run_slab_jobs(int job_type, double *dst, double *src, double w0, double w1);
+
+		//value and gradient of Lanes::WIDTH interior cells, index holds their lower nodes and
+		//delta the dx, dy and dz blocks. Lanes is one of the vector types in the .cpp
+		template <class Lanes>
+		void restrict_cells(const double *sfarray, const int *index, const double *delta, double **output);
+
+		//NativeDepositFlux() for position[order[q]], q < n. if cell is not NULL the lower node of
+		//the interior cells (-1 for the others) goes to cell[q] and dx, dy, dz to delta[3 * q]
+		void deposit_positions(double **position, const double *flux, const int *order, int n, double *dst, 
+			int *cell, double *delta);
+
+		//weighted sum, min and max of planes [k0, k1) of each species into partial, 3 per species
+		void reduce_slab(double **sfarrays, int nspecies, int k0, int k1, double *partial);
+
+		//x weighted sum of one row, min and max are updated
+		double reduce_row(const double *c, double *minval, double *maxval);
+
+		//copy the positions, fluxes and outputs in cell plane order for NativeExchange()
+		void sort_cell_planes(double **position, double *flux, double **output, int n);
+
+		//deposit and restrict of the cell planes [k0, k1) except the restrict of the 2 planes at either end
+		void exchange_slab(double *sfarray, int k0, int k1);
+
+		//the restrict left over by exchange_slab()
+		void exchange_edges(double *sfarray, int k0, int k1);
+
+		//NativeRestrictVector() for the sorted positions [q0, q1) with the recorded cells and weights
+		void restrict_recorded(double *sfarray, int q0, int q1);
+
+		//run JOB_EXCHANGE or JOB_EXCHANGE_EDGE, job i takes the slabs [first + i * stride, first + i * stride + width)
+		void run_exchange_jobs(int job_type, int first, int stride, int width, double *sfarray);
+
+		//NodeGradientField() for planes [k0, k1)
+		void node_gradient_slab(double *field, const double *sfarray, int k0, int k1);
+
+		//difference along one axis for the node gradient, one sided at zero flux boundaries.
+		//c points to the node, coord is its index along the axis.
+		double axis_difference(const double *c, int coord, int n, int stride)
+		{
+			if (coord > 0 && coord < n - 1)return c[stride] - c[-stride];
+			if (coord == 0)
+			{
+				return isToroidal ? c[stride] - c[(n - 2) * stride] : -3 * c[0] + 4 * c[stride] - c[2 * stride];
+			}
+			return isToroidal ? c[(1 - coord) * stride] - c[-stride] : 3 * c[0] - 4 * c[-stride] + c[-2 * stride];
+		}
+
+		//run a JOB_ACTIVE_* over the active tiles of region
+		void run_tile_jobs(int job_type, NtActiveRegion *region, double *sfarray, double w0, double w1);
+
+		void run_job(EcsRestrictArg *arg);
+
+		//apply the stencil to planes [k0, k1) of src, writing to dst.
+		void stencil_slab(double *dst, const double *src, int k0, int k1, double w0, double w1);
+
+		//index of the neighbouring plane/row, resolved for zero flux (mirror) or toroidal (wrap)
+		int plane_minus(int k)
+		{
+			return k > 0 ? k - 1 : (isToroidal ? NodesPerSide2 - 2 : 1);
+		}
+
+		int plane_plus(int k)
+		{
+			return k < NodesPerSide2m1 ? k + 1 : (isToroidal ? 1 : NodesPerSide2 - 2);
+		}
+
+		int row_minus(int j)
+		{
+			return j > 0 ? j - 1 : (isToroidal ? NodesPerSide1 - 2 : 1);
+		}
+
+		int row_plus(int j)
+		{
+			return j < NodesPerSide1m1 ? j + 1 : (isToroidal ? 1 : NodesPerSide1 - 2);
+		}
+
 		static unsigned __stdcall RestrictThreadEntry(void* pUserData) 
 		{
 			EcsRestrictArg *arg = (EcsRestrictArg *)pUserData;
@@ -151,9 +507,9 @@ namespace NativeDaphneLibrary
 				WaitForSingleObject(owner->JobReadyEvents[tid], INFINITE); 
 				if (arg->n == -1) //signal to end thread
 				{
-					_endthread();
+					return 0;
 				}
-				arg->owner->NativeRestrict(arg->sfarray, arg->position, arg->n, arg->_output);
+				arg->owner->run_job(arg);
 				if (::InterlockedDecrement(&owner->AcitveJobCount) == 0)
 				{
 					//SetEvent(owner->JobFinishedSignal);
@@ -0,0 +1,294 @@
+/*
+Copyright (C) 2019 Kepler Laboratory of Quantitative Immunology
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY 
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH 
+THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "stdafx.h"
+#include <stdlib.h>
+#include "NtOperatorCache.h"
+
+namespace NativeDaphneLibrary
+{
+	NtRestrictTable *NtOperatorCache::restrictTables = NULL;
+	volatile unsigned long NtOperatorCache::cacheLock = 0;
+
+	NtRestrictTable::NtRestrictTable(int* extents, double step_size, bool toroidal)
+	{
+		NodesPerSide0 = extents[0];
+		NodesPerSide1 = extents[1];
+		NodesPerSide2 = extents[2];
+		StepSize = step_size;
+		isToroidal = toroidal;
+		refCount = 0;
+		next = NULL;
+
+		int c0 = NodesPerSide0 - 1, c1 = NodesPerSide1 - 1, c2 = NodesPerSide2 - 1;
+		int inner1 = c1 > 2 ? c1 - 2 : 0;
+		int inner2 = c2 > 2 ? c2 - 2 : 0;
+		numCells = 2 * c0 * c1 + 2 * c0 * inner2 + 2 * inner1 * inner2;
+		cells = (NtIndexMatrix *)malloc(numCells * sizeof(NtIndexMatrix));
+		layerState = (volatile unsigned long *)malloc(c2 * sizeof(unsigned long));
+		for (int k = 0; k < c2; k++)
+		{
+			layerState[k] = LAYER_EMPTY;
+		}
+	}
+
+	NtRestrictTable::~NtRestrictTable()
+	{
+		free(cells);
+		free((void *)layerState);
+	}
+
+	void NtRestrictTable::build_layer(int k)
+	{
+		if (::InterlockedCompareExchange(&layerState[k], LAYER_BUILDING, LAYER_EMPTY) != LAYER_EMPTY)
+		{
+			//another thread is building it
+			while (layerState[k] != LAYER_READY);
+			return;
+		}
+
+		int c0 = NodesPerSide0 - 1, c1 = NodesPerSide1 - 1, c2 = NodesPerSide2 - 1;
+		int NPS01 = NodesPerSide0 * NodesPerSide1;
+		for (int j = 0; j < c1; j++)
+		{
+			//only the first and last cell of the rows inside the layer are on the boundary
+			bool full_row = k == 0 || k == c2 - 1 || j == 0 || j == c1 - 1;
+			int istep = full_row || c0 < 2 ? 1 : c0 - 1;
+			for (int i = 0; i < c0; i += istep)
+			{
+				initialize_index_matrix(i + j * NodesPerSide0 + k * NPS01);
+			}
+		}
+		::InterlockedExchange(&layerState[k], LAYER_READY);
+	}
+
+	//precompute localmatrixes
+	void NtRestrictTable::initialize_index_matrix(int index)
+	{
+		int idxarr[3];
+		int NPS01 = NodesPerSide0 * NodesPerSide1;
+		idxarr[2] = index/NPS01;
+		idxarr[1] = (index%NPS01)/NodesPerSide0;
+		idxarr[0] = (index%NPS01)%NodesPerSide0;
+
+		if (idxarr[0] == NodesPerSide0 - 1)
+		{
+			idxarr[0]--;
+		}
+		if (idxarr[1] == NodesPerSide1 - 1)
+		{
+			idxarr[1]--;
+		}
+		if (idxarr[2] == NodesPerSide2 - 1)
+		{
+			idxarr[2]--;
+		}
+
+		int base_index = index;
+
+		int bound_flag = 0;
+		if (idxarr[0] == 0) bound_flag |= XLEFT;
+		else if (idxarr[0] + 1 == NodesPerSide0 - 1)bound_flag |= XRIGHT;
+		if (idxarr[1] == 0) bound_flag |= YLEFT;
+		else if (idxarr[1] + 1 == NodesPerSide1 - 1)bound_flag |= YRIGHT;
+		if (idxarr[2] == 0)bound_flag |= ZLEFT;
+		else if (idxarr[2] + 1 == NodesPerSide2 - 1)bound_flag |= ZRIGHT;
+
+		//if internal node, we don't compute neighbours
+		if (bound_flag == 0)return;
+
+		NtIndexMatrix *lm = cells + boundary_cell(idxarr[0], idxarr[1], idxarr[2]);
+		lm->boundFlag = bound_flag;
+
+		int *lm_index1 = lm->indexArray;
+		int *lm_index2 = lm->indexArray + 20;
+		int *lm_index3 = lm->indexArray + 40;
+
+		////if its a internal node, then we make the memory contigougs for the index
+		//if (bound_flag == 0)
+		//{
+		//	lm_index2 = lm->indexArray + 16;
+		//	lm_index3 = lm->indexArray + 32;
+		//}
+
+		int n, n1, n2;
+		n = n1 = n2 = 0;
+
+		int node_index = 0;
+		for (int di = 0; di < 2; di++)
+		{
+			for (int dj = 0; dj < 2; dj++)
+			{
+				for (int dk = 0; dk < 2; dk++)
+				{
+					node_index = base_index + di  + dj * NodesPerSide0 + dk * NPS01;
+
+					// 0th element:
+					if (idxarr[0] + di == NodesPerSide0 - 1) //right side ==> di == 1, rightBound == true.
+					{
+						if (isToroidal)
+						{
+							lm_index1[n++] = (1) + (idxarr[1] + dj) * NodesPerSide0 + (idxarr[2] + dk) * NPS01;
+							lm_index1[n++] = node_index -1;
+						}
+						else
+						{
+							lm_index1[n++] = node_index;
+							lm_index1[n++] = node_index-1;
+							lm_index1[n++] = node_index-2;
+						}
+					}
+					else if (idxarr[0] + di == 0) //left bound di == 0 && LeftBound == true
+					{
+						if (isToroidal)
+						{
+							lm_index1[n++] = node_index + 1;
+							lm_index1[n++] =  (NodesPerSide0 - 2) + (idxarr[1] + dj) * NodesPerSide0 + (idxarr[2] + dk) * NPS01;
+							//lm_index1[n] = -1;
+						}
+						else
+						{
+							lm_index1[n++] = node_index;
+							lm_index1[n++] = node_index + 1;
+							lm_index1[n++] = node_index + 2;
+                        }
+					}
+					else
+					{
+						lm_index1[n++] = node_index + 1;
+						lm_index1[n++] = node_index - 1;
+						//lm_index1[n] = -1;
+					}  
+
+					// 1st element:
+					if (idxarr[1] + dj == NodesPerSide1 - 1)
+					{
+						if (isToroidal)
+						{
+							lm_index2[n1++] = (idxarr[0] + di) + (1) * NodesPerSide0 + (idxarr[2] + dk) * NPS01;
+							lm_index2[n1++] = node_index - NodesPerSide0;
+						}
+						else
+                        {
+							lm_index2[n1++] = node_index;
+							lm_index2[n1++] = node_index - NodesPerSide0;
+							lm_index2[n1++] = node_index - NodesPerSide0 * 2;
+                        }
+					}
+                    else if (idxarr[1] + dj == 0)
+					{
+						if (isToroidal)
+						{
+							lm_index2[n1++] = node_index + NodesPerSide0;
+							lm_index2[n1++] = (idxarr[0] + di) + (NodesPerSide1 - 2) * NodesPerSide0 + (idxarr[2] + dk) * NPS01;
+						}
+						else
+						{
+							lm_index2[n1++] = node_index;
+							lm_index2[n1++] = node_index + NodesPerSide0;
+							lm_index2[n1++] = node_index + NodesPerSide0 * 2;
+						}
+					}
+					else
+					{
+						lm_index2[n1++] = node_index + NodesPerSide0;
+						lm_index2[n1++] = node_index - NodesPerSide0;
+					}
+
+					//2nd element
+					if (idxarr[2] + dk == NodesPerSide2 - 1)
+                    {
+						if (isToroidal)
+                        {
+							lm_index3[n2++] = (idxarr[0] + di) + (idxarr[1] + dj) * NodesPerSide0 + (1) * NPS01;
+							lm_index3[n2++] = node_index - NPS01; 
+                        }
+                        else
+                        {
+							lm_index3[n2++] = node_index; // 3, -4, 1
+							lm_index3[n2++] = node_index - NPS01;
+							lm_index3[n2++] = node_index - NPS01 * 2;
+                        }
+					}
+                    else if (idxarr[2] + dk == 0)
+                    {
+						if (isToroidal)
+                        {
+							lm_index3[n2++] = node_index + NPS01;
+							lm_index3[n2++] = (idxarr[0] + di) + (idxarr[1] + dj) * NodesPerSide0 + (NodesPerSide2 - 2) * NPS01;
+                        }
+                        else
+                        {
+							lm_index3[n2++] = node_index; // -3, 4, -1
+							lm_index3[n2++] = node_index + NPS01;
+							lm_index3[n2++] = node_index + NPS01 * 2;
+						}
+					}
+                    else
+                    {
+						lm_index3[n2++] = node_index + NPS01;
+						lm_index3[n2++] = node_index - NPS01;
+					}        
+				}
+			}
+		}
+		
+		if (bound_flag == 0 && (n != 16 || n1 !=16 || n2 != 16))
+		{
+			fprintf(stderr, "Erroring initializing local matrix");
+			exit(1);
+		}
+		else if (n != 16 && n != 20 || n1 != 16 && n1 != 20 || n2 != 16 && n2 != 20)
+		{
+			fprintf(stderr, "Erroring initializing local matrix");
+			exit(1);
+		}
+	}
+
+	NtRestrictTable *NtOperatorCache::AcquireRestrictTable(int* extents, double step_size, bool toroidal)
+	{
+		lock();
+		NtRestrictTable *table = restrictTables;
+		while (table != NULL && !table->Matches(extents, step_size, toroidal))
+		{
+			table = table->next;
+		}
+		if (table == NULL)
+		{
+			table = new NtRestrictTable(extents, step_size, toroidal);
+			table->next = restrictTables;
+			restrictTables = table;
+		}
+		table->refCount++;
+		unlock();
+		return table;
+	}
+
+	void NtOperatorCache::ReleaseRestrictTable(NtRestrictTable *table)
+	{
+		lock();
+		if (--table->refCount == 0)
+		{
+			NtRestrictTable **link = &restrictTables;
+			while (*link != table)
+			{
+				link = &(*link)->next;
+			}
+			*link = table->next;
+			delete table;
+		}
+		unlock();
+	}
+}
@@ -0,0 +1,149 @@
+/*
+Copyright (C) 2019 Kepler Laboratory of Quantitative Immunology
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY 
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH 
+THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+
+#ifdef COMPILE_FLAG
+#define DllExport __declspec(dllexport)
+#else 
+#define DllExport __declspec(dllimport)
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+
+namespace NativeDaphneLibrary
+{
+	//this class stores precomputed gradientMatrix information
+	//indexArray stores 20 x 3 indexes for the 3 gradient matrix components
+	typedef struct DllExport NtIndexMatrix
+	{
+		int boundFlag;
+		int indexArray[60]; 
+	}NtIndexMatrixStr;
+
+	//restrict index tables of the boundary cells of one grid, see NtInterpolatedRectangularPrism::NativeRestrict.
+	//interior cells use array_index_shifts and have no table. a table never changes once built, so all
+	//prisms with the same grid share one through NtOperatorCache. each z layer of cells is built on
+	//first use by the thread that asks for it; a thread that finds the layer being built waits for it.
+	class DllExport NtRestrictTable
+	{
+	public:
+
+		static const int XLEFT = 1;
+		static const int XRIGHT = 2;
+		static const int XBOUND = XLEFT + XRIGHT;
+		static const int YLEFT = 4;
+		static const int YRIGHT = 8;
+		static const int YBOUND = YLEFT + YRIGHT;
+		static const int ZLEFT = 16;
+		static const int ZRIGHT = 32;
+		static const int ZBOUND = ZLEFT + ZRIGHT;
+
+		NtRestrictTable(int* extents, double step_size, bool toroidal);
+
+		~NtRestrictTable();
+
+		//table of the boundary cell with lower node (i, j, k)
+		NtIndexMatrix *Cell(int i, int j, int k)
+		{
+			if (layerState[k] != LAYER_READY)build_layer(k);
+			return cells + boundary_cell(i, j, k);
+		}
+
+		bool Matches(int* extents, double step_size, bool toroidal)
+		{
+			return extents[0] == NodesPerSide0 && extents[1] == NodesPerSide1 && extents[2] == NodesPerSide2 
+				&& step_size == StepSize && toroidal == isToroidal;
+		}
+
+		int NumCells()
+		{
+			return numCells;
+		}
+
+	private:
+
+		friend class NtOperatorCache;
+
+		static const int LAYER_EMPTY = 0;
+		static const int LAYER_BUILDING = 1;
+		static const int LAYER_READY = 2;
+
+		int NodesPerSide0;
+		int NodesPerSide1;
+		int NodesPerSide2;
+		double StepSize;
+		bool isToroidal;
+
+		NtIndexMatrix *cells;
+		int numCells;
+		//one state per z layer of cells
+		volatile unsigned long *layerState;
+
+		//owned by NtOperatorCache
+		int refCount;
+		NtRestrictTable *next;
+
+		void build_layer(int k);
+
+		void initialize_index_matrix(int index);
+
+		//slot in cells of the boundary cell with lower node (i, j, k).
+		//the two z faces come first, then the two y faces and the two x faces
+		//of the rows in between.
+		int boundary_cell(int i, int j, int k)
+		{
+			int c0 = NodesPerSide0 - 1;
+			int c1 = NodesPerSide1 - 1;
+			int c2 = NodesPerSide2 - 1;
+			if (k == 0)return i + j * c0;
+			if (k == c2 - 1)return c0 * c1 + i + j * c0;
+			int base = 2 * c0 * c1;
+			if (j == 0)return base + 2 * (k - 1) * c0 + i;
+			if (j == c1 - 1)return base + (2 * (k - 1) + 1) * c0 + i;
+			base += 2 * (c2 - 2) * c0;
+			return base + 2 * ((k - 1) * (c1 - 2) + j - 1) + (i == 0 ? 0 : 1);
+		}
+	};
+
+	//process wide cache of the immutable operator tables, keyed by (extents, step size, toroidal),
+	//so repetitions and ensemble members on the same grid do not rebuild them.
+	//tables are reference counted and freed with their last user.
+	class DllExport NtOperatorCache
+	{
+	public:
+
+		//the shared table for the grid, created on the first request, layers are built lazily
+		static NtRestrictTable *AcquireRestrictTable(int* extents, double step_size, bool toroidal);
+
+		static void ReleaseRestrictTable(NtRestrictTable *table);
+
+	private:
+
+		static NtRestrictTable *restrictTables;
+		static volatile unsigned long cacheLock;
+
+		static void lock()
+		{
+			while (::InterlockedCompareExchange(&cacheLock, 1, 0) != 0);
+		}
+
+		static void unlock()
+		{
+			::InterlockedExchange(&cacheLock, 0);
+		}
+	};
+}
@@ -0,0 +1,219 @@
+/*
+Copyright (C) 2019 Kepler Laboratory of Quantitative Immunology
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY 
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH 
+THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "stdafx.h"
+#include <acml.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xmmintrin.h>
+#include "NtUtility.h"
+#include "NtSparseOperator.h"
+
+namespace NativeDaphneLibrary
+{
+	NtSparseOperator::NtSparseOperator(int nrows, const int *rowStart, const int *index, const double *coefficient)
+	{
+		NumRows = nrows;
+
+		//merge the repeated indices of each row, e.g. the mirrored neighbours at zero flux boundaries
+		int total = rowStart[nrows];
+		rowPtr = (int *)malloc((nrows + 1) * sizeof(int));
+		colIdx = (int *)malloc((total > 0 ? total : 1) * sizeof(int));
+		values = (double *)malloc((total > 0 ? total : 1) * sizeof(double));
+		int nnz = 0;
+		width = 0;
+		for (int i = 0; i < nrows; i++)
+		{
+			rowPtr[i] = nnz;
+			for (int k = rowStart[i]; k < rowStart[i + 1]; k++)
+			{
+				int m = rowPtr[i];
+				while (m < nnz && colIdx[m] != index[k])m++;
+				if (m == nnz)
+				{
+					colIdx[nnz] = index[k];
+					values[nnz] = 0;
+					nnz++;
+				}
+				values[m] += coefficient[k];
+			}
+			if (nnz - rowPtr[i] > width)width = nnz - rowPtr[i];
+		}
+		rowPtr[nrows] = nnz;
+
+		int padded = ((nrows + 1) / 2) * 2 * width;
+		isEllpack = nrows > 0 && (padded - nnz) * ELL_MAX_PADDING <= nnz;
+		ellIdx = NULL;
+		ellValues = NULL;
+		if (isEllpack)
+		{
+			ellIdx = (int *)malloc(padded * sizeof(int));
+			ellValues = (double *)_aligned_malloc(padded * sizeof(double), 16);
+			for (int i = 0; i < ((nrows + 1) / 2) * 2; i++)
+			{
+				int base = (i >> 1) * width * 2 + (i & 1);
+				int len = i < nrows ? rowPtr[i + 1] - rowPtr[i] : 0;
+				//padding points at a valid node with a zero coefficient
+				int pad_index = i < nrows ? i : 0;
+				for (int k = 0; k < width; k++)
+				{
+					ellIdx[base + 2 * k] = k < len ? colIdx[rowPtr[i] + k] : pad_index;
+					ellValues[base + 2 * k] = k < len ? values[rowPtr[i] + k] : 0;
+				}
+			}
+			free(colIdx);
+			free(values);
+			colIdx = NULL;
+			values = NULL;
+		}
+
+		//thread related setup, see start_threads()
+		MaxNumThreads = acmlgetnumthreads()-4; 
+		if (MaxNumThreads <= 0)MaxNumThreads = 1;
+		jobHandles = NULL;
+		JobReadyEvents = NULL;
+		JobArgs = NULL;
+		NumStartedThreads = 0;
+	}
+
+	NtSparseOperator::~NtSparseOperator()
+	{
+		//terminate thread
+		for (int i=0; i<NumStartedThreads; i++)
+		{
+			JobArgs[i]->n = -1;
+			::SetEvent(JobReadyEvents[i]);
+		}
+		for (int i=0; i<NumStartedThreads; i++)
+		{
+			WaitForSingleObject(jobHandles[i], INFINITE);
+			CloseHandle(jobHandles[i]);
+			CloseHandle(JobReadyEvents[i]);
+			delete JobArgs[i];
+		}
+		free(jobHandles);
+		free(JobReadyEvents);
+		free(JobArgs);
+		free(rowPtr);
+		if (colIdx != NULL)free(colIdx);
+		if (values != NULL)free(values);
+		if (ellIdx != NULL)free(ellIdx);
+		if (ellValues != NULL)_aligned_free(ellValues);
+	}
+
+	void NtSparseOperator::start_threads(int n)
+	{
+		if (n <= NumStartedThreads)return;
+		if (jobHandles == NULL)
+		{
+			jobHandles = (HANDLE *)malloc(MaxNumThreads * sizeof(HANDLE));
+			JobReadyEvents = (HANDLE *)malloc(MaxNumThreads * sizeof(HANDLE));
+			JobArgs = (SparseJobArg **)malloc(MaxNumThreads * sizeof(SparseJobArg*));
+		}
+		for (int i = NumStartedThreads; i < n; i++)
+		{
+			unsigned int tid;
+			JobArgs[i] = new SparseJobArg();
+			JobArgs[i]->owner = this;
+			JobArgs[i]->threadId = i;
+			JobReadyEvents[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
+			jobHandles[i] = (HANDLE)_beginthreadex(0, 0, &SparseThreadEntry, JobArgs[i], 0, &tid);
+		}
+		NumStartedThreads = n;
+	}
+
+	void NtSparseOperator::multiply_rows(const double *x, double *y, int row0, int row1)
+	{
+		if (isEllpack == false)
+		{
+			for (int i = row0; i < row1; i++)
+			{
+				double sum = 0;
+				for (int k = rowPtr[i]; k < rowPtr[i + 1]; k++)
+				{
+					sum += values[k] * x[colIdx[k]];
+				}
+				y[i] = sum;
+			}
+			return;
+		}
+
+		for (int i = row0; i < row1; i += 2)
+		{
+			const int *idx = ellIdx + (i >> 1) * width * 2;
+			const double *val = ellValues + (i >> 1) * width * 2;
+#if defined(USE_SSE)
+			__m128d sum = _mm_setzero_pd();
+			for (int k = 0; k < width; k++)
+			{
+				__m128d xv = _mm_set_pd(x[idx[2 * k + 1]], x[idx[2 * k]]);
+				sum = _mm_add_pd(sum, _mm_mul_pd(_mm_load_pd(val + 2 * k), xv));
+			}
+			double pair[2];
+			_mm_storeu_pd(pair, sum);
+			y[i] = pair[0];
+			if (i + 1 < row1)y[i + 1] = pair[1];
+#else
+			double sum0 = 0, sum1 = 0;
+			for (int k = 0; k < width; k++)
+			{
+				sum0 += val[2 * k] * x[idx[2 * k]];
+				sum1 += val[2 * k + 1] * x[idx[2 * k + 1]];
+			}
+			y[i] = sum0;
+			if (i + 1 < row1)y[i + 1] = sum1;
+#endif
+		}
+	}
+
+	int NtSparseOperator::Multiply(const double *x, double *y)
+	{
+		multiply_rows(x, y, 0, NumRows);
+		return 0;
+	}
+
+	int NtSparseOperator::MultithreadMultiply(const double *x, double *y)
+	{
+		int njobs = NumRows / MIN_JOB_ROWS;
+		if (njobs > MaxNumThreads + 1)njobs = MaxNumThreads + 1;
+		if (njobs < 1)njobs = 1;
+		int numThreads = njobs - 1;
+
+		start_threads(numThreads);
+		::InterlockedExchange(&AcitveJobCount, numThreads);
+		int row0 = 0;
+		for (int i = 0; i < numThreads; i++)
+		{
+			//even block boundaries keep the ELLPACK row pairs together
+			int row1 = ((i + 1) * NumRows / njobs) & ~1;
+			SparseJobArg *arg = JobArgs[i];
+			arg->x = x;
+			arg->y = y;
+			arg->row0 = row0;
+			arg->row1 = row1;
+			arg->n = row1 - row0;
+			row0 = row1;
+			::SetEvent(JobReadyEvents[i]);
+		}
+
+		multiply_rows(x, y, row0, NumRows);
+		//wait for job finish
+		if (numThreads > 0)
+		{
+			while (::InterlockedCompareExchange(&AcitveJobCount, 1, 0) != 0);
+		}
+		return 0;
+	}
+}
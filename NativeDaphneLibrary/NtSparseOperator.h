@@ -0,0 +1,120 @@
+/*
+Copyright (C) 2019 Kepler Laboratory of Quantitative Immunology
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY 
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH 
+THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+
+#ifdef COMPILE_FLAG
+#define DllExport __declspec(dllexport)
+#else 
+#define DllExport __declspec(dllimport)
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <process.h>
+
+namespace NativeDaphneLibrary
+{
+	class NtSparseOperator;
+
+	class DllExport SparseJobArg
+	{
+	public:
+		NtSparseOperator *owner;
+		const double *x;
+		double *y;
+		int row0;
+		int row1;
+		int n;		//-1 to end the thread
+		int threadId;
+	};
+
+	//sparse operator y = A x compiled from the LocalMatrix rows of a NodeInterpolator
+	//(laplacianMatrix()). repeated indices in a row are merged. when the rows have (nearly)
+	//the same length the matrix is stored as ELLPACK, padded with zero coefficients and
+	//interleaved by row pairs so that two rows go through one SSE lane pair, otherwise CSR.
+	class DllExport NtSparseOperator
+	{
+	public:
+
+		//row i has entries [rowStart[i], rowStart[i+1]) of index/coefficient
+		NtSparseOperator(int nrows, const int *rowStart, const int *index, const double *coefficient);
+
+		~NtSparseOperator();
+
+		int Multiply(const double *x, double *y);
+
+		//Multiply() split into row blocks over the worker threads
+		int MultithreadMultiply(const double *x, double *y);
+
+		bool IsEllpack()
+		{
+			return isEllpack;
+		}
+
+	private:
+
+		//ELLPACK is used when padding adds at most 1 / ELL_MAX_PADDING of the entries
+		static const int ELL_MAX_PADDING = 4;
+		//minimum number of rows per job
+		static const int MIN_JOB_ROWS = 4096;
+
+		int NumRows;
+		bool isEllpack;
+
+		//CSR
+		int *rowPtr;
+		int *colIdx;
+		double *values;
+
+		//ELLPACK, row pair p entry k at [(p * width + k) * 2 + (row & 1)]
+		int width;
+		int *ellIdx;
+		double *ellValues;
+
+		//thread stuff
+		int MaxNumThreads;
+		HANDLE* jobHandles;
+		HANDLE* JobReadyEvents;
+		SparseJobArg** JobArgs;
+		unsigned long AcitveJobCount;
+		//worker threads started so far, they are started by the first job that splits
+		int NumStartedThreads;
+
+		//start the worker threads 0..n-1 that are not running yet
+		void start_threads(int n);
+
+		//rows [row0, row1), row0 even for ELLPACK
+		void multiply_rows(const double *x, double *y, int row0, int row1);
+
+		static unsigned __stdcall SparseThreadEntry(void* pUserData) 
+		{
+			SparseJobArg *arg = (SparseJobArg *)pUserData;
+			int tid = arg->threadId;
+			NtSparseOperator *owner = arg->owner;
+
+			while (true)
+			{
+				WaitForSingleObject(owner->JobReadyEvents[tid], INFINITE); 
+				if (arg->n == -1) //signal to end thread
+				{
+					return 0;
+				}
+				owner->multiply_rows(arg->x, arg->y, arg->row0, arg->row1);
+				::InterlockedDecrement(&owner->AcitveJobCount);
+			}
+		}
+	};
+}
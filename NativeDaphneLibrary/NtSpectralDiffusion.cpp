@@ -0,0 +1,351 @@
+/*
+Copyright (C) 2019 Kepler Laboratory of Quantitative Immunology
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY 
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH 
+THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "stdafx.h"
+#include <acml.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdexcept>
+#include "NtSpectralDiffusion.h"
+
+namespace NativeDaphneLibrary
+{
+	static const double TWO_PI = 6.283185307179586476925;
+
+	NtSpectralDiffusion::NtSpectralDiffusion(int* extents, double step_size)
+	{
+		StepSize = step_size;
+		NPS01 = extents[0] * extents[1];
+		maxFactor = 1;
+		maxPeriod = 1;
+		for (int d = 0; d < 3; d++)
+		{
+			NodesPerSide[d] = extents[d];
+			int n = extents[d] - 1;
+			Period[d] = n;
+			if (n > maxPeriod)maxPeriod = n;
+
+			//prime factors, at most log2(n) of them, terminated with 1
+			factors[d] = (int *)malloc(34 * sizeof(int));
+			int nf = 0;
+			int rest = n;
+			for (int p = 2; p * p <= rest; p++)
+			{
+				while (rest % p == 0)
+				{
+					factors[d][nf++] = p;
+					rest /= p;
+				}
+			}
+			if (rest > 1)factors[d][nf++] = rest;
+			factors[d][nf] = 1;
+			for (int i = 0; i < nf; i++)
+			{
+				if (factors[d][i] > maxFactor)maxFactor = factors[d][i];
+			}
+
+			twiddle[d] = (double *)malloc(2 * n * sizeof(double));
+			for (int j = 0; j < n; j++)
+			{
+				double angle = TWO_PI * j / n;
+				twiddle[d][2 * j] = cos(angle);
+				twiddle[d][2 * j + 1] = -sin(angle);
+			}
+		}
+
+		cacheCount = cacheNext = 0;
+		for (int i = 0; i < DECAY_CACHE_SIZE; i++)
+		{
+			cachedDecay[i] = NULL;
+		}
+
+		//thread related setup, the last arg is used by the calling thread.
+		//the workers are started by start_threads()
+		MaxNumThreads = acmlgetnumthreads()-4; 
+		if (MaxNumThreads <= 0)MaxNumThreads = 1;
+		jobHandles = (HANDLE *)malloc(MaxNumThreads * sizeof(HANDLE));
+		JobReadyEvents = (HANDLE *)malloc(MaxNumThreads * sizeof(HANDLE));
+		JobArgs = (SpectralJobArg **)malloc((MaxNumThreads + 1) * sizeof(SpectralJobArg*));
+		JobArgs[MaxNumThreads] = create_job_arg(MaxNumThreads);
+		NumStartedThreads = 0;
+	}
+
+	SpectralJobArg *NtSpectralDiffusion::create_job_arg(int i)
+	{
+		SpectralJobArg *arg = new SpectralJobArg();
+		arg->owner = this;
+		arg->threadId = i;
+		arg->line = (double *)_aligned_malloc((4 * maxPeriod + 2 * maxFactor) * sizeof(double), 32);
+		arg->out = arg->line + 2 * maxPeriod;
+		arg->tmp = arg->out + 2 * maxPeriod;
+		return arg;
+	}
+
+	void NtSpectralDiffusion::start_threads(int n)
+	{
+		for (int i = NumStartedThreads; i < n; i++)
+		{
+			unsigned int tid;
+			JobArgs[i] = create_job_arg(i);
+			JobReadyEvents[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
+			jobHandles[i] = (HANDLE)_beginthreadex(0, 0, &SpectralThreadEntry, JobArgs[i], 0, &tid);
+		}
+		if (n > NumStartedThreads)NumStartedThreads = n;
+	}
+
+	NtSpectralDiffusion::~NtSpectralDiffusion()
+	{
+		//terminate thread
+		for (int i=0; i<NumStartedThreads; i++)
+		{
+			JobArgs[i]->n = -1;
+			::SetEvent(JobReadyEvents[i]);
+		}
+		for (int i=0; i<NumStartedThreads; i++)
+		{
+			WaitForSingleObject(jobHandles[i], INFINITE);
+			CloseHandle(jobHandles[i]);
+			CloseHandle(JobReadyEvents[i]);
+			_aligned_free(JobArgs[i]->line);
+			delete JobArgs[i];
+		}
+		_aligned_free(JobArgs[MaxNumThreads]->line);
+		delete JobArgs[MaxNumThreads];
+		free(jobHandles);
+		free(JobReadyEvents);
+		free(JobArgs);
+		for (int d = 0; d < 3; d++)
+		{
+			free(factors[d]);
+			free(twiddle[d]);
+		}
+		for (int i = 0; i < cacheCount; i++)
+		{
+			free(cachedDecay[i]);
+		}
+	}
+
+	//decay factors exp(alpha * lambda_k) for the eigenvalues lambda_k = (2 cos(2 pi k/n) - 2)/h^2
+	//of the periodic second difference, with the 1/n of the inverse transform folded in.
+	double *NtSpectralDiffusion::get_decay(double alpha)
+	{
+		for (int i = 0; i < cacheCount; i++)
+		{
+			if (cachedAlpha[i] == alpha)return cachedDecay[i];
+		}
+
+		int slot;
+		if (cacheCount < DECAY_CACHE_SIZE)
+		{
+			slot = cacheCount++;
+			cachedDecay[slot] = (double *)malloc((Period[0] + Period[1] + Period[2]) * sizeof(double));
+		}
+		else
+		{
+			slot = cacheNext;
+			cacheNext = (cacheNext + 1) % DECAY_CACHE_SIZE;
+		}
+		cachedAlpha[slot] = alpha;
+		double *decay = cachedDecay[slot];
+		double h2inv = 1.0 / (StepSize * StepSize);
+		for (int d = 0; d < 3; d++)
+		{
+			int n = Period[d];
+			for (int k = 0; k < n; k++)
+			{
+				double lambda = (2 * cos(TWO_PI * k / n) - 2) * h2inv;
+				decay[k] = exp(alpha * lambda) / n;
+			}
+			decay += n;
+		}
+		return cachedDecay[slot];
+	}
+
+	/***************************************************************************************************
+	 * mixed radix decimation in time transform of n complex values in[j * istride] into out.
+	 * the sub transforms of the p interleaved sequences go to consecutive blocks of out,
+	 * the butterflies of size p then combine element k of each block in place.
+	 * tw is the twiddle table of the top level transform, tw[j * twstride] = exp(-2 pi i j / n).
+	 ***************************************************************************************************/
+	void NtSpectralDiffusion::fft(const double *in, int istride, double *out, int n, const int *fac, 
+			const double *tw, int twstride, double *tmp)
+	{
+		if (n == 1)
+		{
+			out[0] = in[0];
+			out[1] = in[1];
+			return;
+		}
+		int p = fac[0];
+		int m = n / p;
+		for (int q = 0; q < p; q++)
+		{
+			fft(in + 2 * q * istride, istride * p, out + 2 * q * m, m, fac + 1, tw, twstride * p, tmp);
+		}
+
+		for (int k = 0; k < m; k++)
+		{
+			for (int q = 0; q < p; q++)
+			{
+				const double *w = tw + 2 * (((q * k) % n) * twstride);
+				double re = out[2 * (q * m + k)];
+				double im = out[2 * (q * m + k) + 1];
+				tmp[2 * q] = re * w[0] - im * w[1];
+				tmp[2 * q + 1] = re * w[1] + im * w[0];
+			}
+			if (p == 2)
+			{
+				out[2 * k] = tmp[0] + tmp[2];
+				out[2 * k + 1] = tmp[1] + tmp[3];
+				out[2 * (k + m)] = tmp[0] - tmp[2];
+				out[2 * (k + m) + 1] = tmp[1] - tmp[3];
+				continue;
+			}
+			for (int s = 0; s < p; s++)
+			{
+				double re = 0, im = 0;
+				for (int q = 0; q < p; q++)
+				{
+					const double *w = tw + 2 * (((q * s * m) % n) * twstride);
+					re += tmp[2 * q] * w[0] - tmp[2 * q + 1] * w[1];
+					im += tmp[2 * q] * w[1] + tmp[2 * q + 1] * w[0];
+				}
+				out[2 * (k + s * m)] = re;
+				out[2 * (k + s * m) + 1] = im;
+			}
+		}
+	}
+
+	//line l of a direction starts at (l % period_a) * stride_a + (l / period_a) * stride_b,
+	//a and b being the other two directions. only the unique (periodic) lines are transformed.
+	void NtSpectralDiffusion::transform_lines(SpectralJobArg *arg)
+	{
+		int d = arg->direction;
+		int da = d == 0 ? 1 : 0;
+		int db = d == 2 ? 1 : 2;
+		int strides[3] = {1, NodesPerSide[0], NPS01};
+		int sd = strides[d];
+		int sa = strides[da];
+		int sb = strides[db];
+		int pa = Period[da];
+		int nlines = Period[da] * Period[db];
+		int n = Period[d];
+		const double *decay = arg->decay;
+		for (int i = 0; i < d; i++)decay += Period[i];
+
+		double *sf = arg->sfarray;
+		double *line = arg->line;
+		double *out = arg->out;
+		int end = arg->start + arg->n;
+		for (int pair = arg->start; pair < end; pair++)
+		{
+			int l0 = 2 * pair;
+			int l1 = l0 + 1;
+			double *src0 = sf + (l0 % pa) * sa + (l0 / pa) * sb;
+			double *src1 = l1 < nlines ? sf + (l1 % pa) * sa + (l1 / pa) * sb : NULL;
+			for (int j = 0; j < n; j++)
+			{
+				line[2 * j] = src0[j * sd];
+				line[2 * j + 1] = src1 != NULL ? src1[j * sd] : 0;
+			}
+
+			fft(line, 1, out, n, factors[d], twiddle[d], 1, arg->tmp);
+			//scale and conjugate, the inverse is the conjugate of the forward transform of the conjugate
+			for (int k = 0; k < n; k++)
+			{
+				line[2 * k] = out[2 * k] * decay[k];
+				line[2 * k + 1] = -out[2 * k + 1] * decay[k];
+			}
+			fft(line, 1, out, n, factors[d], twiddle[d], 1, arg->tmp);
+
+			for (int j = 0; j < n; j++)
+			{
+				src0[j * sd] = out[2 * j];
+			}
+			if (src1 != NULL)
+			{
+				for (int j = 0; j < n; j++)
+				{
+					src1[j * sd] = -out[2 * j + 1];
+				}
+			}
+		}
+	}
+
+	int NtSpectralDiffusion::Diffuse(double *sfarray, double alpha)
+	{
+		double *decay = get_decay(alpha);
+		for (int d = 0; d < 3; d++)
+		{
+			int da = d == 0 ? 1 : 0;
+			int db = d == 2 ? 1 : 2;
+			int npairs = (Period[da] * Period[db] + 1) / 2;
+
+			int numThreads = MaxNumThreads;
+			int NumItemsPerThread = npairs /(numThreads + 1);
+			if (NumItemsPerThread < 8)
+			{
+				NumItemsPerThread = 8;
+				numThreads = npairs/8 - 1;
+				if (numThreads < 0)numThreads = 0;
+			}
+
+			start_threads(numThreads);
+			::InterlockedExchange(&AcitveJobCount, numThreads);
+			int nn = npairs - NumItemsPerThread * numThreads;
+			for (int i=0; i< numThreads; i++)
+			{
+				SpectralJobArg *arg = JobArgs[i];
+				arg->sfarray = sfarray;
+				arg->decay = decay;
+				arg->direction = d;
+				arg->start = nn;
+				arg->n = NumItemsPerThread;
+				nn += NumItemsPerThread;
+				::SetEvent(JobReadyEvents[i]);
+			}
+
+			SpectralJobArg *arg = JobArgs[MaxNumThreads];
+			arg->sfarray = sfarray;
+			arg->decay = decay;
+			arg->direction = d;
+			arg->start = 0;
+			arg->n = npairs - NumItemsPerThread * numThreads;
+			transform_lines(arg);
+
+			//wait for job finish
+			if (numThreads > 0)
+			{
+				while (::InterlockedCompareExchange(&AcitveJobCount, 1, 0) != 0);
+			}
+		}
+
+		//node N-1 is the same point as node 0
+		int n0 = NodesPerSide[0];
+		for (int k = 0; k < Period[2]; k++)
+		{
+			double *plane = sfarray + k * NPS01;
+			for (int j = 0; j < Period[1]; j++)
+			{
+				plane[j * n0 + n0 - 1] = plane[j * n0];
+			}
+			memcpy(plane + Period[1] * n0, plane, n0 * sizeof(double));
+		}
+		memcpy(sfarray + Period[2] * NPS01, sfarray, NPS01 * sizeof(double));
+		return 0;
+	}
+
+}
@@ -0,0 +1,129 @@
+/*
+Copyright (C) 2019 Kepler Laboratory of Quantitative Immunology
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY 
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH 
+THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+
+#ifdef COMPILE_FLAG
+#define DllExport __declspec(dllexport)
+#else 
+#define DllExport __declspec(dllimport)
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <process.h>
+
+namespace NativeDaphneLibrary
+{
+	class NtSpectralDiffusion;
+
+	class DllExport SpectralJobArg
+	{
+	public:
+		NtSpectralDiffusion *owner;
+		double *sfarray;
+		double *decay;
+		int direction;
+		int start;	//first line pair
+		int n;		//number of line pairs, -1 to end the thread
+		int threadId;
+		//per thread line buffers, complex values stored as re, im
+		double *line;
+		double *out;
+		double *tmp;
+	};
+
+	//exact diffusion propagator sfarray = exp(alpha * L) sfarray for toroidal grids,
+	//L being the discrete 7-point laplacian. node N-1 is the same point as node 0 along each
+	//direction, so the periodic grid has N-1 unknowns per direction.
+	//the 1d operators commute, the propagator is applied one direction at a time by
+	//transforming the lines, scaling each wave number by its decay factor and transforming back.
+	//two real lines are packed into one complex transform, the decay factors are real and
+	//even so the two lines stay separated in the real and imaginary parts.
+	class DllExport NtSpectralDiffusion
+	{
+	public:
+
+		//number of alpha values (i.e. species/time step combinations) kept in the decay cache
+		static const int DECAY_CACHE_SIZE = 16;
+
+		NtSpectralDiffusion(int* extents, double step_size);
+
+		~NtSpectralDiffusion();
+
+		int Diffuse(double *sfarray, double alpha);
+
+	private:
+
+		int NodesPerSide[3];
+		int NPS01;
+		//periodic length for each direction, NodesPerSide - 1
+		int Period[3];
+		double StepSize;
+
+		//factors of the period and twiddle table exp(-2 pi i j / period)
+		int *factors[3];
+		double *twiddle[3];
+		int maxFactor;
+		int maxPeriod;
+
+		//decay factors exp(alpha * lambda_k) / period for each direction, keyed by alpha
+		double cachedAlpha[DECAY_CACHE_SIZE];
+		double *cachedDecay[DECAY_CACHE_SIZE];
+		int cacheCount;
+		int cacheNext;
+
+		//thread stuff
+		int MaxNumThreads;
+		HANDLE* jobHandles;
+		HANDLE* JobReadyEvents;
+		SpectralJobArg** JobArgs;
+		unsigned long AcitveJobCount;
+		//worker threads started so far, they are started by the first transform that splits
+		int NumStartedThreads;
+
+		//job arg i with its line buffers
+		SpectralJobArg *create_job_arg(int i);
+
+		//start the worker threads 0..n-1 that are not running yet
+		void start_threads(int n);
+
+		double *get_decay(double alpha);
+
+		//transform line pairs [start, start + n) along direction, using the buffers in arg
+		void transform_lines(SpectralJobArg *arg);
+
+		void fft(const double *in, int istride, double *out, int n, const int *fac, 
+			const double *tw, int twstride, double *tmp);
+
+		static unsigned __stdcall SpectralThreadEntry(void* pUserData) 
+		{
+			SpectralJobArg *arg = (SpectralJobArg *)pUserData;
+			int tid = arg->threadId;
+			NtSpectralDiffusion *owner = arg->owner;
+
+			while (true)
+			{
+				WaitForSingleObject(owner->JobReadyEvents[tid], INFINITE); 
+				if (arg->n == -1) //signal to end thread
+				{
+					return 0;
+				}
+				owner->transform_lines(arg);
+				::InterlockedDecrement(&owner->AcitveJobCount);
+			}
+		}
+	};
+}
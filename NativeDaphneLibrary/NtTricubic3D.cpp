@@ -0,0 +1,336 @@
+/*
+Copyright (C) 2019 Kepler Laboratory of Quantitative Immunology
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY 
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH 
+THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "stdafx.h"
+#include <acml.h>
+#include <stdlib.h>
+#include <string.h>
+#include "NtTricubic3D.h"
+
+namespace NativeDaphneLibrary
+{
+	NtTricubic3D::NtTricubic3D(int* extents, double step_size, bool toroidal)
+	{
+		StepSize = step_size;
+		isToroidal = toroidal;
+		int stride = 1;
+		for (int d = 0; d < 3; d++)
+		{
+			NodesPerSide[d] = extents[d];
+			Stride[d] = stride;
+			stride *= extents[d];
+		}
+
+		//each cell contributes the integrals of its four cubic weights,
+		//-1/24, 13/24, 13/24, -1/24, to the nodes it reads
+		double cell_integral[4] = {-1.0/24, 13.0/24, 13.0/24, -1.0/24};
+		for (int d = 0; d < 3; d++)
+		{
+			int n = NodesPerSide[d];
+			integrationWeights[d] = (double *)malloc(n * sizeof(double));
+			memset(integrationWeights[d], 0, n * sizeof(double));
+			for (int c = 0; c < n - 1; c++)
+			{
+				for (int a = 0; a < 4; a++)
+				{
+					integrationWeights[d][wrap_node(c - 1 + a, d)] += cell_integral[a] * StepSize;
+				}
+			}
+		}
+
+		//thread related setup, see start_threads()
+		MaxNumThreads = acmlgetnumthreads()-4; 
+		if (MaxNumThreads <= 0)MaxNumThreads = 1;
+		jobHandles = NULL;
+		JobReadyEvents = NULL;
+		JobArgs = NULL;
+		NumStartedThreads = 0;
+	}
+
+	NtTricubic3D::~NtTricubic3D()
+	{
+		//terminate thread
+		for (int i=0; i<NumStartedThreads; i++)
+		{
+			JobArgs[i]->n = -1;
+			::SetEvent(JobReadyEvents[i]);
+		}
+		for (int i=0; i<NumStartedThreads; i++)
+		{
+			WaitForSingleObject(jobHandles[i], INFINITE);
+			CloseHandle(jobHandles[i]);
+			CloseHandle(JobReadyEvents[i]);
+			delete JobArgs[i];
+		}
+		free(jobHandles);
+		free(JobReadyEvents);
+		free(JobArgs);
+		for (int d = 0; d < 3; d++)
+		{
+			free(integrationWeights[d]);
+		}
+	}
+
+	void NtTricubic3D::start_threads(int n)
+	{
+		if (n <= NumStartedThreads)return;
+		if (jobHandles == NULL)
+		{
+			jobHandles = (HANDLE *)malloc(MaxNumThreads * sizeof(HANDLE));
+			JobReadyEvents = (HANDLE *)malloc(MaxNumThreads * sizeof(HANDLE));
+			JobArgs = (TricubicJobArg **)malloc(MaxNumThreads * sizeof(TricubicJobArg*));
+		}
+		for (int i = NumStartedThreads; i < n; i++)
+		{
+			unsigned int tid;
+			JobArgs[i] = new TricubicJobArg();
+			JobArgs[i]->owner = this;
+			JobArgs[i]->threadId = i;
+			JobReadyEvents[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
+			jobHandles[i] = (HANDLE)_beginthreadex(0, 0, &TricubicThreadEntry, JobArgs[i], 0, &tid);
+		}
+		NumStartedThreads = n;
+	}
+
+	int NtTricubic3D::wrap_node(int i, int d)
+	{
+		int last = NodesPerSide[d] - 1;
+		if (i < 0)return isToroidal ? i + last : -i;
+		if (i > last)return isToroidal ? i - last : 2 * last - i;
+		return i;
+	}
+
+	void NtTricubic3D::axis_weights(double x, int d, int *offset, double *w, double *dw)
+	{
+		double tmpval = x / StepSize;
+		int idx = (int)tmpval;
+		if (idx == NodesPerSide[d] - 1)idx--;
+		double t = tmpval - idx;
+		double t2 = t * t;
+		double t3 = t2 * t;
+
+		w[0] = 0.5 * (-t3 + 2 * t2 - t);
+		w[1] = 0.5 * (3 * t3 - 5 * t2 + 2);
+		w[2] = 0.5 * (-3 * t3 + 4 * t2 + t);
+		w[3] = 0.5 * (t3 - t2);
+
+		//derivative with respect to position, not t
+		double hinv = 0.5 / StepSize;
+		dw[0] = hinv * (-3 * t2 + 4 * t - 1);
+		dw[1] = hinv * (9 * t2 - 10 * t);
+		dw[2] = hinv * (-9 * t2 + 8 * t + 1);
+		dw[3] = hinv * (3 * t2 - 2 * t);
+
+		for (int a = 0; a < 4; a++)
+		{
+			offset[a] = wrap_node(idx - 1 + a, d) * Stride[d];
+		}
+	}
+
+	int NtTricubic3D::NativeWeights(double **position, int n, int *index, double *weight)
+	{
+		int ox[4], oy[4], oz[4];
+		double wx[4], wy[4], wz[4], dw[4];
+		for (int p = 0; p < n; p++)
+		{
+			double *pos = position[p];
+			axis_weights(pos[0], 0, ox, wx, dw);
+			axis_weights(pos[1], 1, oy, wy, dw);
+			axis_weights(pos[2], 2, oz, wz, dw);
+			int *idx = index + p * NUM_WEIGHTS;
+			double *w = weight + p * NUM_WEIGHTS;
+			int m = 0;
+			for (int c = 0; c < 4; c++)
+			{
+				for (int b = 0; b < 4; b++)
+				{
+					double wyz = wy[b] * wz[c];
+					int oyz = oy[b] + oz[c];
+					for (int a = 0; a < 4; a++, m++)
+					{
+						idx[m] = ox[a] + oyz;
+						w[m] = wx[a] * wyz;
+					}
+				}
+			}
+		}
+		return 0;
+	}
+
+	int NtTricubic3D::NativeGradientWeights(double **position, int n, int *index, double *weight)
+	{
+		int ox[4], oy[4], oz[4];
+		double wx[4], wy[4], wz[4], dx[4], dy[4], dz[4];
+		for (int p = 0; p < n; p++)
+		{
+			double *pos = position[p];
+			axis_weights(pos[0], 0, ox, wx, dx);
+			axis_weights(pos[1], 1, oy, wy, dy);
+			axis_weights(pos[2], 2, oz, wz, dz);
+			int *idx = index + p * NUM_WEIGHTS;
+			double *gx = weight + p * 3 * NUM_WEIGHTS;
+			double *gy = gx + NUM_WEIGHTS;
+			double *gz = gy + NUM_WEIGHTS;
+			int m = 0;
+			for (int c = 0; c < 4; c++)
+			{
+				for (int b = 0; b < 4; b++)
+				{
+					int oyz = oy[b] + oz[c];
+					for (int a = 0; a < 4; a++, m++)
+					{
+						idx[m] = ox[a] + oyz;
+						gx[m] = dx[a] * wy[b] * wz[c];
+						gy[m] = wx[a] * dy[b] * wz[c];
+						gz[m] = wx[a] * wy[b] * dz[c];
+					}
+				}
+			}
+		}
+		return 0;
+	}
+
+	//the x sums of each of the 16 node rows are shared by the value and the three gradients
+	int NtTricubic3D::NativeRestrict(double *sfarray, double** position, int n, double **output)
+	{
+		int ox[4], oy[4], oz[4];
+		double wx[4], wy[4], wz[4], dx[4], dy[4], dz[4];
+		for (int p = 0; p < n; p++)
+		{
+			double *pos = position[p];
+			double *out = output[p];
+			axis_weights(pos[0], 0, ox, wx, dx);
+			axis_weights(pos[1], 1, oy, wy, dy);
+			axis_weights(pos[2], 2, oz, wz, dz);
+
+			double value = 0, gx = 0, gy = 0, gz = 0;
+			for (int c = 0; c < 4; c++)
+			{
+				double sv = 0, sx = 0, sy = 0;
+				for (int b = 0; b < 4; b++)
+				{
+					const double *row = sfarray + oy[b] + oz[c];
+					double f0 = row[ox[0]], f1 = row[ox[1]], f2 = row[ox[2]], f3 = row[ox[3]];
+					double rv = wx[0] * f0 + wx[1] * f1 + wx[2] * f2 + wx[3] * f3;
+					double rd = dx[0] * f0 + dx[1] * f1 + dx[2] * f2 + dx[3] * f3;
+					sv += wy[b] * rv;
+					sx += wy[b] * rd;
+					sy += dy[b] * rv;
+				}
+				value += wz[c] * sv;
+				gx += wz[c] * sx;
+				gy += wz[c] * sy;
+				gz += dz[c] * sv;
+			}
+			out[0] = value;
+			out[1] = gx;
+			out[2] = gy;
+			out[3] = gz;
+		}
+		return 0;
+	}
+
+	int NtTricubic3D::MultithreadNativeRestrict(double *sfarray, double** position, int n, double **output)
+	{
+		int numThreads = MaxNumThreads;
+		int NumItemsPerThread = n /(numThreads + 1);
+		if (NumItemsPerThread < MIN_JOB_POSITIONS)
+		{
+			NumItemsPerThread = MIN_JOB_POSITIONS;
+			numThreads = n / MIN_JOB_POSITIONS - 1;
+			if (numThreads < 0)numThreads = 0;
+		}
+
+		start_threads(numThreads);
+		::InterlockedExchange(&AcitveJobCount, numThreads);
+		int n0, nn;
+		n0 = nn = n - NumItemsPerThread * numThreads;
+		for (int i=0; i< numThreads; i++)
+		{
+			TricubicJobArg *arg = JobArgs[i];
+			arg->sfarray = sfarray;
+			arg->position = position + nn;
+			arg->output = output + nn;
+			arg->n = NumItemsPerThread;
+			nn += NumItemsPerThread;
+			::SetEvent(JobReadyEvents[i]);
+		}
+
+		NativeRestrict(sfarray, position, n0, output);
+		//wait for job finish
+		if (numThreads > 0)
+		{
+			while (::InterlockedCompareExchange(&AcitveJobCount, 1, 0) != 0);
+		}
+		return 0;
+	}
+
+	//weights and volume factors are separable, the factor is applied per axis
+	int NtTricubic3D::NativeDepositFlux(double **position, double *flux, int n, double *dst)
+	{
+		int offset[3][4];
+		double w[3][4], dw[4];
+		for (int p = 0; p < n; p++)
+		{
+			double *pos = position[p];
+			for (int d = 0; d < 3; d++)
+			{
+				axis_weights(pos[d], d, offset[d], w[d], dw);
+				int last = (NodesPerSide[d] - 1) * Stride[d];
+				for (int a = 0; a < 4; a++)
+				{
+					if (offset[d][a] == 0 || offset[d][a] == last)w[d][a] *= 2;
+				}
+			}
+			for (int c = 0; c < 4; c++)
+			{
+				for (int b = 0; b < 4; b++)
+				{
+					double wyz = w[1][b] * w[2][c] * flux[p];
+					double *row = dst + offset[1][b] + offset[2][c];
+					for (int a = 0; a < 4; a++)
+					{
+						row[offset[0][a]] += w[0][a] * wyz;
+					}
+				}
+			}
+		}
+		return 0;
+	}
+
+	double NtTricubic3D::Integrate(double *sfarray)
+	{
+		double *cx = integrationWeights[0];
+		double *cy = integrationWeights[1];
+		double *cz = integrationWeights[2];
+		double sum = 0;
+		for (int k = 0; k < NodesPerSide[2]; k++)
+		{
+			double sumk = 0;
+			for (int j = 0; j < NodesPerSide[1]; j++)
+			{
+				const double *row = sfarray + j * Stride[1] + k * Stride[2];
+				double sumj = 0;
+				for (int i = 0; i < NodesPerSide[0]; i++)
+				{
+					sumj += cx[i] * row[i];
+				}
+				sumk += cy[j] * sumj;
+			}
+			sum += cz[k] * sumk;
+		}
+		return sum;
+	}
+}
@@ -0,0 +1,128 @@
+/*
+Copyright (C) 2019 Kepler Laboratory of Quantitative Immunology
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY 
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH 
+THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+
+#ifdef COMPILE_FLAG
+#define DllExport __declspec(dllexport)
+#else 
+#define DllExport __declspec(dllimport)
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <process.h>
+
+namespace NativeDaphneLibrary
+{
+	class NtTricubic3D;
+
+	class DllExport TricubicJobArg
+	{
+	public:
+		NtTricubic3D *owner;
+		double *sfarray;
+		double **position;
+		double **output;
+		int n;		//-1 to end the thread
+		int threadId;
+	};
+
+	//native kernels for Tricubic3D. the interpolant is the separable Catmull-Rom cubic
+	//over the 4x4x4 nodes around the cell, the gradient is its exact derivative.
+	//node index is i + j * N0 + k * N0 * N1. outside the grid the node is mirrored
+	//(zero flux), for toroidal grids node N-1 is the same point as node 0.
+	class DllExport NtTricubic3D
+	{
+	public:
+
+		static const int NUM_WEIGHTS = 64;
+
+		NtTricubic3D(int* extents, double step_size, bool toroidal);
+
+		~NtTricubic3D();
+
+		//interpolation weights of n positions, NUM_WEIGHTS index/weight pairs per position
+		int NativeWeights(double **position, int n, int *index, double *weight);
+
+		//gradient weights of n positions, NUM_WEIGHTS indices and 3 * NUM_WEIGHTS weights
+		//per position, stored as the d/dx, d/dy and d/dz blocks
+		int NativeGradientWeights(double **position, int n, int *index, double *weight);
+
+		//value and gradient at n positions, output[p] holds value, d/dx, d/dy, d/dz.
+		//same shape as NtInterpolatedRectangularPrism::NativeRestrict
+		int NativeRestrict(double *sfarray, double** position, int n, double **output);
+
+		int MultithreadNativeRestrict(double *sfarray, double** position, int n, double **output);
+
+		//scatter of the boundary flux sources with the interpolation weights, the transpose of the
+		//interpolation. dst[node] += volFactor * weight * flux[p], volFactor doubles for each axis
+		//on which the node lies on the boundary, see NodeInterpolator::DiffusionFlux().
+		int NativeDepositFlux(double **position, double *flux, int n, double *dst);
+
+		//integral of the interpolant over the prism
+		double Integrate(double *sfarray);
+
+	private:
+
+		//minimum number of positions per restrict job
+		static const int MIN_JOB_POSITIONS = 20;
+
+		int NodesPerSide[3];
+		int Stride[3];
+		double StepSize;
+		bool isToroidal;
+
+		//per axis integration weights of the nodes, see Integrate()
+		double *integrationWeights[3];
+
+		//thread stuff
+		int MaxNumThreads;
+		HANDLE* jobHandles;
+		HANDLE* JobReadyEvents;
+		TricubicJobArg** JobArgs;
+		unsigned long AcitveJobCount;
+		//worker threads started so far, they are started by the first job that splits
+		int NumStartedThreads;
+
+		//start the worker threads 0..n-1 that are not running yet
+		void start_threads(int n);
+
+		//the four node offsets (premultiplied by the stride) and the cubic
+		//weights and their derivatives along axis d for coordinate x
+		void axis_weights(double x, int d, int *offset, double *w, double *dw);
+
+		//node index i along axis d mapped back onto the grid
+		int wrap_node(int i, int d);
+
+		static unsigned __stdcall TricubicThreadEntry(void* pUserData) 
+		{
+			TricubicJobArg *arg = (TricubicJobArg *)pUserData;
+			int tid = arg->threadId;
+			NtTricubic3D *owner = arg->owner;
+
+			while (true)
+			{
+				WaitForSingleObject(owner->JobReadyEvents[tid], INFINITE); 
+				if (arg->n == -1) //signal to end thread
+				{
+					return 0;
+				}
+				owner->NativeRestrict(arg->sfarray, arg->position, arg->n, arg->output);
+				::InterlockedDecrement(&owner->AcitveJobCount);
+			}
+		}
+	};
+}
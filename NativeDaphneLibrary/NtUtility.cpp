@@ -24,6 +24,7 @@ THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 //testing avx
 #include <immintrin.h>
+#include <intrin.h>
 
 namespace NativeDaphneLibrary
 {
@@ -35,6 +36,31 @@ namespace NativeDaphneLibrary
 	//	return 0;
 	//}
 
+	int NtUtility::SimdLevel()
+	{
+		static int level = -1;
+		if (level >= 0)return level;
+
+		int info[4];
+		int result = SIMD_NONE;
+		__cpuid(info, 0);
+		int max_leaf = info[0];
+		__cpuid(info, 1);
+		//osxsave and avx
+		bool os_avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0;
+		if (os_avx && max_leaf >= 7)
+		{
+			unsigned long long xcr0 = _xgetbv(0);
+			__cpuidex(info, 7, 0);
+			//ymm state enabled by the os and avx2
+			if ((xcr0 & 0x6) == 0x6 && (info[1] & (1 << 5)) != 0)result = SIMD_AVX2;
+			//opmask and zmm state, avx512f
+			if ((xcr0 & 0xe6) == 0xe6 && (info[1] & (1 << 16)) != 0)result = SIMD_AVX512;
+		}
+		level = result;
+		return level;
+	}
+
 	//multiply two scalars and save result in z, inc = 4
 	int NtUtility::MomentExpansion_NtMultiplyScalar(int n, double *x, double *y)
 	{
@@ -71,6 +71,14 @@ namespace NativeDaphneLibrary
 
 		static int mem_zero_d(double*dst, int count);
 
+		//vector instruction sets usable on this machine, checked once with cpuid.
+		//the kernels using them are compiled in regardless of /arch.
+		static const int SIMD_NONE = 0;
+		static const int SIMD_AVX2 = 1;
+		static const int SIMD_AVX512 = 2;
+
+		static int SimdLevel();
+
 		static int mem_copy_d(double *dst, double *src, int count);
 
 #define USE_SSE